@@ -0,0 +1,118 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <algorithm>
+#include <inttypes.h>
+
+/****************************************************************************************
+ * PCM lookback. Recently decoded PCM is kept by track and position (in bytes from start of
+ * track), oldest is dropped past capacity. When decoder restarts a track somewhere we have
+ * (seek, previous), what we have can be replayed right away and what decoder sends again
+ * is dropped. Nothing must be written while replaying
+ */
+class pcmLookback {
+private:
+    struct chunk {
+        std::string track;
+        size_t position;
+        std::vector<uint8_t> data;
+    };
+
+    static constexpr size_t chunkSize = 256 * 1024;
+    std::mutex mutex;
+    std::deque<chunk> chunks;
+    size_t capacity, used = 0;
+    // where decoder is in its track
+    std::string track;
+    size_t position = 0;
+    // what is left to replay and how much of decoder's data it replaces
+    size_t replayFrom = 0, replayTo = 0, skip = 0;
+
+    chunk* find(size_t at) {
+        auto it = std::find_if(chunks.begin(), chunks.end(), [&](auto& c) {
+            return c.track == track && at >= c.position && at < c.position + c.data.size();
+        });
+        return it == chunks.end() ? nullptr : &*it;
+    }
+
+public:
+    pcmLookback(size_t capacity) : capacity(capacity) { }
+
+    // 16 bits stereo at 44.1kHz
+    static size_t bytes(uint32_t ms) { return (uint64_t) ms * 44100 / 1000 * 4; }
+
+    // decoder (re)starts a track at position, returns how much is in lookback from there
+    size_t start(std::string_view track, size_t position) {
+        std::scoped_lock lock(mutex);
+        this->track = track;
+        replayFrom = replayTo = position;
+        for (chunk* c; (c = find(replayTo)) != nullptr;) replayTo = c->position + c->data.size();
+        skip = replayTo - replayFrom;
+        // once replay is done, decoder's data goes after what we have
+        this->position = replayTo;
+        return skip;
+    }
+
+    // next data to replay (NULL when done), caller says how much it has used
+    const uint8_t* replay(size_t& size) {
+        std::scoped_lock lock(mutex);
+        chunk* c = replayFrom < replayTo ? find(replayFrom) : nullptr;
+        if (!c) {
+            // what we can't replay can't be dropped either
+            skip -= std::min(skip, replayTo - replayFrom);
+            replayFrom = replayTo;
+            return NULL;
+        }
+        size = std::min(size, c->position + c->data.size() - replayFrom);
+        return c->data.data() + replayFrom - c->position;
+    }
+
+    void replayed(size_t size) {
+        std::scoped_lock lock(mutex);
+        replayFrom += size;
+    }
+
+    // how much of what decoder sends has already been replayed
+    size_t drop(size_t size) {
+        std::scoped_lock lock(mutex);
+        size = std::min(size, skip);
+        skip -= size;
+        return size;
+    }
+
+    void write(const uint8_t* data, size_t size) {
+        std::scoped_lock lock(mutex);
+        if (!capacity) return;
+
+        while (size) {
+            if (chunks.empty() || chunks.back().track != track || chunks.back().data.size() == chunkSize ||
+                chunks.back().position + chunks.back().data.size() != position) {
+                chunks.push_back({ track, position });
+                chunks.back().data.reserve(chunkSize);
+            }
+
+            auto& c = chunks.back();
+            size_t bytes = std::min(size, chunkSize - c.data.size());
+            c.data.insert(c.data.end(), data, data + bytes);
+            position += bytes;
+            used += bytes;
+            data += bytes;
+            size -= bytes;
+        }
+
+        while (used > capacity && chunks.size() > 1) {
+            used -= chunks.front().data.size();
+            chunks.pop_front();
+        }
+    }
+};
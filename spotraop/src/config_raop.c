@@ -65,6 +65,7 @@ void SaveConfig(char *name, void *ref, bool full) {
 
 	XMLUpdateNode(doc, root, false, "interface", glInterface);
 	XMLUpdateNode(doc, root, false, "ports", "%hu:%hu", glPortBase, glPortRange);
+	XMLUpdateNode(doc, root, false, "lookback", "%u", glLookback);
 	XMLUpdateNode(doc, root, false, "credentials_path", glCredentialsPath);
 	XMLUpdateNode(doc, root, false, "credentials", "%d", glCredentials);
 
@@ -167,6 +168,7 @@ static void LoadGlobalItem(char *name, char *val) {
 	if (!strcmp(name, "util_log")) util_loglevel = debug2level(val);
 	if (!strcmp(name, "log_limit")) glLogLimit = atol(val);
 	if (!strcmp(name, "ports")) sscanf(val, "%hu:%hu", &glPortBase, &glPortRange);
+	if (!strcmp(name, "lookback")) glLookback = atol(val);
  }
 
 
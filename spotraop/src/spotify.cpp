@@ -36,6 +36,7 @@ extern "C" {
 
 #include "spotify.h"
 #include "metadata.h"
+#include "pcmLookback.h"
 
 #define BYTES_PER_FRAME 4
 
@@ -45,7 +46,7 @@ extern "C" {
 
 class CSpotPlayer : public bell::Task {
 private:     
-    std::mutex runningMutex;
+    std::mutex runningMutex, pcmMutex;
     bell::WrappedSemaphore clientConnected;
     std::string streamTrackUnique;
     std::atomic<bool> isPaused = true;
@@ -70,6 +71,7 @@ private:
     uint32_t delay;
     size_t scratchSize;
     uint8_t scratch[DEFAULT_FRAMES_PER_CHUNK * BYTES_PER_FRAME];
+    pcmLookback lookback;
 
     std::unique_ptr<bell::MDNSService> mdnsService;
 
@@ -81,6 +83,8 @@ private:
     auto postHandler(struct mg_connection* conn);
     void eventHandler(std::unique_ptr<cspot::SpircHandler::Event> event);
     size_t writePCM(uint8_t* pcm, size_t bytes, std::string_view trackId);
+    size_t sendPCM(const uint8_t* pcm, size_t bytes);
+    bool replayPCM(void);
     void enableZeroConf(void);
     
     void runTask();
@@ -90,6 +94,7 @@ public:
     std::atomic<TrackStatus> trackStatus = TRACK_INIT;
     inline static uint16_t portBase = 0, portRange = 1;
     inline static std::string username = "", password = "";
+    inline static uint32_t lookbackSize = 0;
 
     CSpotPlayer(char* name, char* id, char *credentials, struct in_addr addr, AudioFormat audio, 
                 size_t frameSize, uint32_t delay, struct shadowPlayer* shadow);
@@ -102,7 +107,8 @@ CSpotPlayer::CSpotPlayer(char* name, char* id, char *credentials, struct in_addr
                          size_t frameSize, uint32_t delay, struct shadowPlayer* shadow) 
             : bell::Task("playerInstance", 48 * 1024, 0, 0), 
             clientConnected(1), addr(addr), name(name), credentials(credentials), 
-            shadow(shadow), frameSize(frameSize), delay(delay), format(format) {
+            shadow(shadow), frameSize(frameSize), delay(delay), format(format),
+            lookback(pcmLookback::bytes(lookbackSize * 1000)) {
     this->raopClient = shadowRaop(shadow);
 }
 
@@ -138,22 +144,7 @@ CSpotPlayer::~CSpotPlayer() {
     CSPOT_LOG(info, "done", name.c_str());
 }
 
-size_t CSpotPlayer::writePCM(uint8_t* pcm, size_t bytes, std::string_view trackUnique) {
-    // make sure we don't have a dead lock with a disconnect()
-    if (!isRunning || isPaused || flushed) return 0;
-
-    if (streamTrackUnique != trackUnique) {
-        CSPOT_LOG(info, "trackUniqueId update %s => %s", streamTrackUnique.c_str(), trackUnique.data());
-        streamTrackUnique = trackUnique;
-
-        if (trackStatus != TRACK_INIT) startOffset = 0;
-
-        /* We could send the notifyAudio() here but that would be delay seconds too early so it's
-         * not great to use timers instead of events but in that case it's for sure that we'll
-         * start at the set time - airplay is just a long wire */
-        startTime = gettime_ms64() + delay;
-    }
-
+size_t CSpotPlayer::sendPCM(const uint8_t* pcm, size_t bytes) {
     if (!raopcl_accept_frames(raopClient)) return (size_t) 0;
 
     // do we have enough samples (unless it's last packet)
@@ -163,7 +154,7 @@ size_t CSpotPlayer::writePCM(uint8_t* pcm, size_t bytes, std::string_view trackU
         return bytes;
     }
 
-    uint8_t* data = pcm;
+    uint8_t* data = (uint8_t*) pcm;
     uint64_t playtime;
     size_t consumed = min(bytes, frameSize * BYTES_PER_FRAME);
 
@@ -181,6 +172,48 @@ size_t CSpotPlayer::writePCM(uint8_t* pcm, size_t bytes, std::string_view trackU
     return consumed;
 }
 
+bool CSpotPlayer::replayPCM(void) {
+    // send what lookback has until RAOP client can't take more
+    for (size_t bytes = frameSize * BYTES_PER_FRAME;; bytes = frameSize * BYTES_PER_FRAME) {
+        auto data = lookback.replay(bytes);
+        if (!data) return true;
+        if ((bytes = sendPCM(data, bytes)) == 0) return false;
+        lookback.replayed(bytes);
+    }
+}
+
+size_t CSpotPlayer::writePCM(uint8_t* pcm, size_t bytes, std::string_view trackUnique) {
+    // make sure we don't have a dead lock with a disconnect()
+    if (!isRunning || isPaused || flushed) return 0;
+
+    std::scoped_lock lock(pcmMutex);
+
+    if (streamTrackUnique != trackUnique) {
+        CSPOT_LOG(info, "trackUniqueId update %s => %s", streamTrackUnique.c_str(), trackUnique.data());
+        streamTrackUnique = trackUnique;
+
+        if (trackStatus != TRACK_INIT) startOffset = 0;
+
+        // a track played again (previous, repeat) might be in lookback
+        if (size_t cached = lookback.start(trackUnique, pcmLookback::bytes(startOffset))) {
+            CSPOT_LOG(info, "replaying %zu bytes from lookback at %d", cached, startOffset);
+        }
+
+        /* We could send the notifyAudio() here but that would be delay seconds too early so it's
+         * not great to use timers instead of events but in that case it's for sure that we'll
+         * start at the set time - airplay is just a long wire */
+        startTime = gettime_ms64() + delay;
+    }
+
+    // replay first and then drop what decoder sends again
+    if (!replayPCM()) return 0;
+    if (size_t dropped = lookback.drop(bytes)) return dropped;
+
+    size_t consumed = sendPCM(pcm, bytes);
+    lookback.write(pcm, consumed);
+    return consumed;
+}
+
 auto CSpotPlayer::postHandler(struct mg_connection* conn) {
 #ifdef BELL_ONLY_CJSON
     cJSON* obj = cJSON_CreateObject();
@@ -300,13 +333,27 @@ void CSpotPlayer::eventHandler(std::unique_ptr<cspot::SpircHandler::Event> event
             break;
         }
 
-        scratchSize = 0;
-        startOffset = std::get<int>(event->data);
-        raopcl_stop(raopClient);
-        raopcl_flush(raopClient);
+        {
+            std::scoped_lock lock(pcmMutex);
+            scratchSize = 0;
+            startOffset = std::get<int>(event->data);
+            raopcl_stop(raopClient);
+            raopcl_flush(raopClient);
+
+            // decoder restarts from there, what lookback has will be sent before its data
+            if (lookback.start(streamTrackUnique, pcmLookback::bytes(startOffset))) {
+                CSPOT_LOG(info, "seeking to %d from lookback", startOffset);
+            }
+        }
 
         // must be done last to make sure the busy loop does not act before
         trackStatus = TRACK_READY;
+
+        // now lookback can be sent right away, busy loop sets position once it streams
+        if (!isPaused) {
+            std::scoped_lock lock(pcmMutex);
+            replayPCM();
+        }
         break;
     case cspot::SpircHandler::EventType::DEPLETED:
         trackStatus = TRACK_END;
@@ -547,13 +594,14 @@ void CSpotPlayer::runTask() {
  * C interface functions
  */
 
-void spotOpen(uint16_t portBase, uint16_t portRange, char *username, char *password) {
+void spotOpen(uint16_t portBase, uint16_t portRange, uint32_t lookback, char *username, char *password) {
     if (!bell::bellGlobalLogger) {
         bell::setDefaultLogger();
         bell::enableTimestampLogging(true);
     }
     CSpotPlayer::portBase = portBase;
     if (portRange) CSpotPlayer::portRange = portRange;
+    CSpotPlayer::lookbackSize = lookback;
     if (username) CSpotPlayer::username = username;
     if (password) CSpotPlayer::password = password;
 }
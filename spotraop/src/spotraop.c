@@ -56,6 +56,7 @@ enum { VOLUME_FEEDBACK = 1, VOLUME_UNFILTERED = 2};
 int32_t				glLogLimit = -1;
 uint32_t			glNetmask;
 uint16_t			glPortBase, glPortRange;
+uint32_t			glLookback = 0;
 char 				glInterface[128] = "?";
 char				glExcludedModels[STR_LEN] = "aircast,airupnp,airesp32,";
 char				glIncludedNames[STR_LEN];
@@ -972,7 +973,7 @@ static bool Start(void) {
 	}
 
 	// start cspot
-	spotOpen(glPortBase, glPortRange, glSpotifyUserName, glSpotifyPassword);
+	spotOpen(glPortBase, glPortRange, glLookback, glSpotifyUserName, glSpotifyPassword);
 
 	LOG_INFO("Binding to %s", inet_ntoa(glHost));
 
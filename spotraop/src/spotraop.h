@@ -88,6 +88,7 @@ extern tMRConfig			glMRConfig;
 extern struct sMR			glMRDevices[MAX_RENDERERS];
 extern char					glExcluded[STR_LEN];
 extern uint16_t				glPortBase, glPortRange;
+extern uint32_t				glLookback;
 extern char					glCredentialsPath[STR_LEN];
 extern bool					glCredentials;
 
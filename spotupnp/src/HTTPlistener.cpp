@@ -0,0 +1,180 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#define closesocket(s) close(s)
+#else
+#include <ws2tcpip.h>
+#endif
+
+#include "Logger.h"
+
+#include "HTTPlistener.h"
+#include "HTTPstreamer.h"
+
+// slow or silent peers must not hold sockets forever
+#define MAX_INCOMING        64
+#define REQUEST_TIMEOUT_MS  5000
+
+/****************************************************************************************
+ * Shared listener
+ */
+
+HTTPlistener::HTTPlistener(struct in_addr addr) : reactor(HTTPreactor::get()) {
+    struct sockaddr_in host = { 0 };
+    host.sin_addr = addr;
+    host.sin_family = AF_INET;
+
+    listenSock = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSock < 0) throw std::runtime_error("can't create socket " + std::string(strerror(errno)));
+
+    uint16_t portBase = HTTPstreamer::portBase, portRange = HTTPstreamer::portRange;
+
+    for (int count = 0, offset = rand();; count++, offset++) {
+        host.sin_port = htons(portBase + (offset % portRange));
+        if (!bind(listenSock, (const sockaddr*) &host, sizeof(host))) break;
+        if (!portBase || count == portRange) {
+            closesocket(listenSock);
+            throw std::runtime_error("can't bind on port " + std::string(strerror(errno)));
+        }
+    }
+
+    socklen_t len = sizeof(host);
+    getsockname(listenSock, (struct sockaddr*) &host, &len);
+    port = ntohs(host.sin_port);
+
+    // all streamers of that interface share it, so allow some backlog
+    if (::listen(listenSock, 32) < 0) {
+        closesocket(listenSock);
+        throw std::runtime_error("listen failed on port " + std::to_string(port) + ": " + std::string(strerror(errno)));
+    }
+
+    setNonBlocking(listenSock);
+    reactor->attach(this);
+    reactor->watch(listenSock, this, READ);
+
+    CSPOT_LOG(info, "HTTP listener on %s:%u", inet_ntoa(addr), port);
+}
+
+HTTPlistener::~HTTPlistener(void) {
+    reactor->detach(this);
+    for (auto& [sock, item] : incoming) closesocket(sock);
+    closesocket(listenSock);
+}
+
+void HTTPlistener::add(const std::string& id, HTTPstreamer* streamer) {
+    std::scoped_lock lock(routesMutex);
+    routes[id] = streamer;
+}
+
+void HTTPlistener::remove(const std::string& id, HTTPstreamer* streamer) {
+    // once we return, listener will never hand anything to that streamer
+    std::scoped_lock lock(routesMutex);
+    if (auto it = routes.find(id); it != routes.end() && it->second == streamer) routes.erase(it);
+}
+
+void HTTPlistener::onEvent(int sock, int events) {
+    if (sock == listenSock) {
+        int client;
+
+        while ((client = accept(listenSock, NULL, NULL)) >= 0) {
+            if (incoming.size() >= MAX_INCOMING) {
+                CSPOT_LOG(info, "too many HTTP connections waiting for a request, refusing");
+                closesocket(client);
+                continue;
+            }
+            setNonBlocking(client);
+            incoming[client] = { "", std::chrono::steady_clock::now() + std::chrono::milliseconds(REQUEST_TIMEOUT_MS) };
+            reactor->watch(client, this, READ);
+        }
+
+        reactor->tick(this, !incoming.empty());
+        return;
+    }
+
+    auto it = incoming.find(sock);
+    if (it == incoming.end()) return;
+
+    auto& request = it->second.request;
+    char buffer[256];
+    int n;
+
+    while ((n = recv(sock, buffer, sizeof(buffer), 0)) > 0) request.append(buffer, n);
+
+    // peer is gone or it is not talking HTTP
+    if (n == 0 || (n < 0 && !wouldBlock()) || request.size() > 4096) drop(sock);
+    // we only need the request line
+    else if (request.find("\r\n") != std::string::npos) route(sock);
+}
+
+void HTTPlistener::onTick(void) {
+    auto now = std::chrono::steady_clock::now();
+
+    // drop() erases from incoming, so move on first
+    for (auto it = incoming.begin(); it != incoming.end();) {
+        if (it->second.deadline > now) {
+            ++it;
+            continue;
+        }
+        int sock = (it++)->first;
+        CSPOT_LOG(info, "no HTTP request on socket %d in time, closing", sock);
+        drop(sock);
+    }
+}
+
+void HTTPlistener::drop(int sock) {
+    reactor->unwatch(sock);
+    closesocket(sock);
+    incoming.erase(sock);
+    reactor->tick(this, !incoming.empty());
+}
+
+void HTTPlistener::route(int sock) {
+    auto request = std::move(incoming[sock].request);
+    incoming.erase(sock);
+    reactor->unwatch(sock);
+    reactor->tick(this, !incoming.empty());
+
+    // streamId runs till the end of the query's parameter
+    std::string id;
+    auto line = request.substr(0, request.find("\r\n"));
+    if (auto pos = line.find("?id="); pos != std::string::npos) {
+        id = line.substr(pos + 4, line.find_first_of(" &", pos) - pos - 4);
+    }
+
+    {
+        std::scoped_lock lock(routesMutex);
+        if (auto it = routes.find(id); it != routes.end()) {
+            it->second->handoff(sock, std::move(request));
+            return;
+        }
+    }
+
+    CSPOT_LOG(info, "no HTTP streamer for %s", line.c_str());
+    const char* response = "HTTP/1.0 404 Not Found\r\nServer: spot-connect\r\nConnection: close\r\n\r\n";
+    (void) !send(sock, response, strlen(response), 0);
+    closesocket(sock);
+}
+
+HTTPlistener* HTTPlistener::get(struct in_addr addr) {
+    std::scoped_lock lock(poolMutex);
+    auto& listener = pool[addr.s_addr];
+    if (!listener) listener = std::make_unique<HTTPlistener>(addr);
+    return listener.get();
+}
+
+void HTTPlistener::closeAll(void) {
+    std::scoped_lock lock(poolMutex);
+    pool.clear();
+}
@@ -0,0 +1,62 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <inttypes.h>
+#ifndef _WIN32
+#include <netinet/in.h>
+#endif
+
+#ifdef _WIN32
+#include "win32shim.h"
+#endif
+
+#include "HTTPreactor.h"
+
+class HTTPstreamer;
+
+/****************************************************************************************
+ * Listening socket shared by all streamers of an interface. Once the request line of a
+ * new connection has arrived, it is handed over to the streamer whose id is in the URL,
+ * together with what has been received so far. Streamers only need to register their id
+ */
+class HTTPlistener : public reactorHandler {
+private:
+    int listenSock = -1;
+    uint16_t port;
+    HTTPreactor* reactor;
+    // connections waiting for their request line, which must come before deadline
+    struct pending {
+        std::string request;
+        std::chrono::steady_clock::time_point deadline;
+    };
+    std::map<int, pending> incoming;
+    std::mutex routesMutex;
+    std::unordered_map<std::string, HTTPstreamer*> routes;
+    inline static std::map<uint32_t, std::unique_ptr<HTTPlistener>> pool;
+    inline static std::mutex poolMutex;
+
+    void onEvent(int sock, int events);
+    void onTick(void);
+    void drop(int sock);
+    void route(int sock);
+
+public:
+    HTTPlistener(struct in_addr addr);
+    ~HTTPlistener(void);
+    uint16_t getPort(void) { return port; }
+    void add(const std::string& id, HTTPstreamer* streamer);
+    void remove(const std::string& id, HTTPstreamer* streamer);
+    static HTTPlistener* get(struct in_addr addr);
+    static void closeAll(void);
+};
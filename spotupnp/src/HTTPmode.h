@@ -17,7 +17,10 @@ enum { HTTP_CL_CHUNKED = -3, HTTP_CL_KNOWN = -2, HTTP_CL_NONE = -1, HTTP_CL_REAL
  * almost virtually as a fisdk. But I don' know, some players might have weird requests 
  * like (to receieve the same track since the begining but using HTTP only */
 
-enum { HTTP_CACHE_MEM = 0, HTTP_CACHE_INFINITE, HTTP_CACHE_DISK };
+/* Mode 3 keeps recent data in memory and copies all of it to a disk file as it arrives, so
+ * that anything can be requested again (in flow mode as well) */
+
+enum { HTTP_CACHE_MEM = 0, HTTP_CACHE_INFINITE, HTTP_CACHE_DISK, HTTP_CACHE_TIERED };
 
 char* makeDLNA_ORG(const char* codec, bool fullCache, bool live);
 
@@ -0,0 +1,462 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <ws2tcpip.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#include "Logger.h"
+
+#include "HTTPreactor.h"
+
+#ifndef _WIN32
+#define closesocket(s) close(s)
+#endif
+
+#define TICK_MS 1000
+
+/****************************************************************************************
+ * Socket helpers
+ */
+
+bool setNonBlocking(int sock) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    return flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+bool wouldBlock(void) {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+/****************************************************************************************
+ * Reactor
+ */
+
+HTTPreactor::HTTPreactor(void) : bell::Task("HTTP reactor", 32 * 1024, 0, 0) {
+#ifdef __linux__
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    notifier = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || notifier < 0) throw std::runtime_error("can't create epoll " + std::string(strerror(errno)));
+
+    struct epoll_event event = { 0 };
+    event.events = EPOLLIN;
+    event.data.fd = notifier;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, notifier, &event);
+
+#ifdef HAS_IO_URING
+    // ring's fd is readable when there are completions, so it's just another socket for epoll
+    if (useUring) try {
+        uring = std::make_unique<HTTPuring>();
+        buffers.resize(uring->buffers);
+        event.data.fd = uring->fd();
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, uring->fd(), &event);
+        CSPOT_LOG(info, "using io_uring for sending (zero-copy:%d, fixed buffers:%u)", uring->zeroCopy, uring->buffers);
+    } catch (std::exception& e) {
+        CSPOT_LOG(error, "io_uring unavailable, using regular sockets (%s)", e.what());
+    }
+#endif
+#else
+    // a UDP socket connected to itself works wherever select() does
+    struct sockaddr_in addr = { 0 };
+    socklen_t len = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    notifier = socket(AF_INET, SOCK_DGRAM, 0);
+    if (notifier < 0 || bind(notifier, (struct sockaddr*) &addr, len) ||
+        getsockname(notifier, (struct sockaddr*) &addr, &len) ||
+        ::connect(notifier, (struct sockaddr*) &addr, len)) {
+        throw std::runtime_error("can't create notifier " + std::string(strerror(errno)));
+    }
+
+    setNonBlocking(notifier);
+#endif
+}
+
+HTTPreactor::~HTTPreactor(void) {
+    isRunning = false;
+    wakeup();
+    std::scoped_lock lock(runningMutex);
+#ifdef HAS_IO_URING
+    uring.reset();
+#endif
+#ifdef __linux__
+    close(epollFd);
+    close(notifier);
+#else
+    closesocket(notifier);
+#endif
+}
+
+void HTTPreactor::attach(reactorHandler* handler) {
+    std::scoped_lock lock(mutex);
+    handlers.insert(handler);
+}
+
+void HTTPreactor::detach(reactorHandler* handler) {
+    // once we own the mutex, handler can't be in the middle of a callback
+    std::unique_lock lock(mutex);
+    handlers.erase(handler);
+    ticking.erase(handler);
+    for (auto it = watches.begin(); it != watches.end();) {
+        if (it->second.handler != handler) ++it;
+        else unwatch((it++)->first);
+    }
+
+#ifdef HAS_IO_URING
+    if (!uring) return;
+
+    auto pending = [this, handler]() {
+        return std::any_of(sending.begin(), sending.end(), [handler](auto& item) { return item.second.handler == handler; });
+    };
+
+    // sends in progress use handler's memory, so cancel them and wait till kernel is done
+    for (auto& [id, item] : sending) {
+        if (item.handler != handler) continue;
+        auto sqe = uring->getSqe();
+        if (!sqe && uring->submit() >= 0) sqe = uring->getSqe();
+        if (!sqe) continue;
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = id;
+    }
+
+    uring->submit();
+
+    while (pending()) {
+        if (std::this_thread::get_id() == owner) {
+            uring->submit(1);
+            reap();
+        } else {
+            lock.unlock();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            lock.lock();
+        }
+    }
+#endif
+}
+
+void HTTPreactor::watch(int sock, reactorHandler* handler, int events) {
+    std::scoped_lock lock(mutex);
+    auto it = watches.find(sock);
+
+    // nothing to do if we already have the same events
+    if (it != watches.end() && it->second.events == events && it->second.handler == handler) return;
+
+#ifdef __linux__
+    struct epoll_event event = { 0 };
+    event.data.fd = sock;
+    if (events & reactorHandler::READ) event.events |= EPOLLIN;
+    if (events & reactorHandler::WRITE) event.events |= EPOLLOUT;
+    epoll_ctl(epollFd, it == watches.end() ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, sock, &event);
+#endif
+
+    watches[sock] = { handler, events };
+
+#ifndef __linux__
+    // select() needs to rebuild its sets
+    if (std::this_thread::get_id() != owner) wakeup();
+#endif
+}
+
+void HTTPreactor::unwatch(int sock) {
+    std::scoped_lock lock(mutex);
+    if (!watches.erase(sock)) return;
+#ifdef __linux__
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, sock, NULL);
+#else
+    if (std::this_thread::get_id() != owner) wakeup();
+#endif
+}
+
+void HTTPreactor::notify(reactorHandler* handler) {
+    {
+        std::scoped_lock lock(notifyMutex);
+        if (std::find(notified.begin(), notified.end(), handler) == notified.end()) notified.push_back(handler);
+    }
+
+    // only one pending signal is enough
+    if (!signaled.exchange(true)) wakeup();
+}
+
+void HTTPreactor::tick(reactorHandler* handler, bool enable) {
+    // reactor's thread owns the mutex already, it will set its timeout before next wait
+    std::scoped_lock lock(mutex);
+    if (!enable) ticking.erase(handler);
+    else if (ticking.insert(handler).second && ticking.size() == 1) lastTick = std::chrono::steady_clock::now();
+}
+
+bool HTTPreactor::async(void) {
+#ifdef HAS_IO_URING
+    return uring != nullptr;
+#else
+    return false;
+#endif
+}
+
+bool HTTPreactor::send(reactorHandler* handler, int sock, struct msghdr* msg) {
+#ifdef HAS_IO_URING
+    std::scoped_lock lock(mutex);
+    if (!uring) return false;
+
+    auto sqe = uring->getSqe();
+    if (!sqe && uring->submit() >= 0) sqe = uring->getSqe();
+    if (!sqe) return false;
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < msg->msg_iovlen; i++) bytes += msg->msg_iov[i].iov_len;
+
+    sqe->fd = sock;
+    sqe->user_data = ++sendId;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->addr = (uint64_t) msg;
+    sqe->len = 1;
+
+#ifdef IORING_CQE_F_NOTIF
+    // zero-copy is only worth it for large sends and it's even better from a registered buffer
+    if (uring->zeroCopy && bytes >= 8192) {
+        auto& iov = msg->msg_iov[0];
+        auto it = std::find_if(buffers.begin(), buffers.end(), [&iov, msg](auto& buffer) {
+            return msg->msg_iovlen == 1 && (uint8_t*) iov.iov_base >= buffer.first &&
+                   (uint8_t*) iov.iov_base + iov.iov_len <= buffer.first + buffer.second;
+        });
+
+        if (it != buffers.end()) {
+            sqe->opcode = IORING_OP_SEND_ZC;
+            sqe->addr = (uint64_t) iov.iov_base;
+            sqe->len = iov.iov_len;
+            sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+            sqe->buf_index = it - buffers.begin();
+        } else {
+            sqe->opcode = IORING_OP_SENDMSG_ZC;
+        }
+    }
+#endif
+
+    sending[sendId] = { handler, sock, 0 };
+    return true;
+#else
+    return false;
+#endif
+}
+
+int HTTPreactor::registerBuffer(const void* base, size_t size) {
+#ifdef HAS_IO_URING
+    std::scoped_lock lock(mutex);
+    if (!uring || !uring->zeroCopy) return -1;
+
+    auto it = std::find_if(buffers.begin(), buffers.end(), [](auto& buffer) { return !buffer.first; });
+    if (it == buffers.end()) return -1;
+
+    // this pins memory and is limited by RLIMIT_MEMLOCK
+    if (!uring->setBuffer(it - buffers.begin(), base, size)) {
+        CSPOT_LOG(info, "can't register buffer of %zu bytes (%s)", size, strerror(errno));
+        return -1;
+    }
+
+    *it = { (const uint8_t*) base, size };
+    return it - buffers.begin();
+#else
+    return -1;
+#endif
+}
+
+void HTTPreactor::unregisterBuffer(int index) {
+#ifdef HAS_IO_URING
+    std::scoped_lock lock(mutex);
+    if (!uring || index < 0) return;
+    uring->setBuffer(index, NULL, 0);
+    buffers[index] = { NULL, 0 };
+#endif
+}
+
+#ifdef HAS_IO_URING
+void HTTPreactor::reap(void) {
+    struct io_uring_cqe cqe;
+
+    while (uring->getCqe(cqe)) {
+        // cancel requests are not tracked
+        auto it = sending.find(cqe.user_data);
+        if (it == sending.end()) continue;
+
+        // zero-copy sends give a result first then a notification once memory is released
+        if (!(cqe.flags & IORING_CQE_F_NOTIF)) it->second.result = cqe.res;
+        if (cqe.flags & IORING_CQE_F_MORE) continue;
+
+        auto item = it->second;
+        sending.erase(it);
+        if (handlers.count(item.handler)) item.handler->onSent(item.sock, item.result);
+    }
+}
+#endif
+
+void HTTPreactor::wakeup(void) {
+#ifdef __linux__
+    uint64_t one = 1;
+    (void) !write(notifier, &one, sizeof(one));
+#else
+    ::send(notifier, "", 1, 0);
+#endif
+}
+
+void HTTPreactor::wait(int timeout) {
+    ready.clear();
+
+#ifdef __linux__
+    struct epoll_event events[32];
+    int n = epoll_wait(epollFd, events, sizeof(events) / sizeof(*events), timeout);
+
+    for (int i = 0; i < n; i++) {
+        int flags = 0;
+        // errors and hang-up are reported as readable so that handler can find out
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) flags |= reactorHandler::READ;
+        if (events[i].events & EPOLLOUT) flags |= reactorHandler::WRITE;
+        ready.push_back({ (int) events[i].data.fd, flags });
+    }
+#else
+    fd_set rfds, wfds;
+    std::vector<int> socks = { notifier };
+    int maxSock = notifier;
+
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    FD_SET(notifier, &rfds);
+
+    {
+        std::scoped_lock lock(mutex);
+        for (auto& [sock, item] : watches) {
+            if (item.events & reactorHandler::READ) FD_SET(sock, &rfds);
+            if (item.events & reactorHandler::WRITE) FD_SET(sock, &wfds);
+            if (!item.events) continue;
+            socks.push_back(sock);
+            maxSock = std::max(maxSock, sock);
+        }
+    }
+
+    struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+    if (select(maxSock + 1, &rfds, &wfds, NULL, timeout < 0 ? NULL : &tv) <= 0) return;
+
+    for (auto sock : socks) {
+        int flags = 0;
+        if (FD_ISSET(sock, &rfds)) flags |= reactorHandler::READ;
+        if (FD_ISSET(sock, &wfds)) flags |= reactorHandler::WRITE;
+        if (flags) ready.push_back({ sock, flags });
+    }
+#endif
+}
+
+void HTTPreactor::runTask() {
+    std::scoped_lock lock(runningMutex);
+    owner = std::this_thread::get_id();
+
+    int timeout = -1;
+
+    while (isRunning) {
+        bool woken = false;
+
+        // no timeout, we'll be notified, unless somebody has deadlines to check
+        wait(timeout);
+
+        std::scoped_lock lock(mutex);
+
+        // socket might have been removed (or even re-used) since wait() has returned
+        for (auto& [sock, events] : ready) {
+            if (sock == notifier) {
+                woken = true;
+                continue;
+            }
+#ifdef HAS_IO_URING
+            if (uring && sock == uring->fd()) {
+                reap();
+                continue;
+            }
+#endif
+            auto it = watches.find(sock);
+            if (it != watches.end() && (it->second.events & events)) it->second.handler->onEvent(sock, events);
+        }
+
+        if (woken) {
+#ifdef __linux__
+            uint64_t count;
+            (void) !read(notifier, &count, sizeof(count));
+#else
+            char buffer[16];
+            while (recv(notifier, buffer, sizeof(buffer), 0) > 0);
+#endif
+            // re-arm before taking the list so that we can't miss anybody
+            signaled = false;
+
+            std::vector<reactorHandler*> list;
+            {
+                std::scoped_lock lock(notifyMutex);
+                list.swap(notified);
+            }
+
+            // handler might have been detached in-between
+            for (auto handler : list) {
+                if (handlers.count(handler)) handler->onNotify();
+            }
+        }
+
+        // events might keep wait() from timing out, so rely on time only
+        if (auto now = std::chrono::steady_clock::now(); !ticking.empty() && now - lastTick >= std::chrono::milliseconds(TICK_MS)) {
+            lastTick = now;
+            // handler might stop ticking from its callback
+            auto list = ticking;
+            for (auto handler : list) {
+                if (ticking.count(handler)) handler->onTick();
+            }
+        }
+        timeout = ticking.empty() ? -1 : TICK_MS;
+
+#ifdef HAS_IO_URING
+        // everything that handlers have queued goes in one syscall
+        if (uring) uring->submit();
+#endif
+    }
+}
+
+HTTPreactor* HTTPreactor::get(void) {
+    std::scoped_lock lock(poolMutex);
+    unsigned count = std::max(std::thread::hardware_concurrency(), 1u);
+
+    // create reactors on-demand, up to one per core, then round-robin
+    if (pool.size() < count) {
+        pool.push_back(std::make_unique<HTTPreactor>());
+        pool.back()->startTask();
+        CSPOT_LOG(info, "created HTTP reactor %zu/%u", pool.size(), count);
+        return pool.back().get();
+    }
+
+    return pool[next++ % pool.size()].get();
+}
+
+void HTTPreactor::closeAll(void) {
+    std::scoped_lock lock(poolMutex);
+    pool.clear();
+}
@@ -0,0 +1,112 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+
+#include "BellTask.h"
+#ifdef _WIN32
+#include "win32shim.h"
+#else
+#include <sys/socket.h>
+#endif
+
+#include "HTTPuring.h"
+
+/****************************************************************************************
+ * Whoever owns sockets served by a reactor
+ */
+class reactorHandler {
+public:
+    enum { NONE = 0, READ = 0x01, WRITE = 0x02 };
+    virtual ~reactorHandler(void) { }
+    virtual void onEvent(int sock, int events) = 0;
+    virtual void onNotify(void) { }
+    virtual void onSent(int sock, ssize_t result) { }
+    virtual void onTick(void) { }
+};
+
+/****************************************************************************************
+ * Event loop serving sockets of all streamers. There is at most one per core and handlers
+ * are always called from the same reactor and with its mutex locked. Other threads can
+ * wake up a handler using notify(), there is no polling. Handlers that have deadlines to
+ * enforce can ask for a tick (about every second) while they need it. When io_uring is
+ * used, handlers can also send() asynchronously and all sends of a loop are submitted at once
+ */
+class HTTPreactor : public bell::Task {
+private:
+    struct watchItem {
+        reactorHandler* handler;
+        int events;
+    };
+
+    std::atomic<bool> isRunning = true;
+    std::mutex runningMutex;
+    std::recursive_mutex mutex;
+    std::map<int, watchItem> watches;
+    std::set<reactorHandler*> handlers;
+    std::set<reactorHandler*> ticking;
+    std::chrono::steady_clock::time_point lastTick;
+    std::vector<std::pair<int, int>> ready;
+    std::mutex notifyMutex;
+    std::vector<reactorHandler*> notified;
+    std::atomic<bool> signaled = false;
+    int notifier = -1;
+    std::thread::id owner;
+#ifdef __linux__
+    int epollFd = -1;
+#endif
+#ifdef HAS_IO_URING
+    struct sendItem {
+        reactorHandler* handler;
+        int sock;
+        ssize_t result;
+    };
+    std::unique_ptr<HTTPuring> uring;
+    std::map<uint64_t, sendItem> sending;
+    uint64_t sendId = 0;
+    std::vector<std::pair<const uint8_t*, size_t>> buffers;
+    void reap(void);
+#endif
+    inline static std::vector<std::unique_ptr<HTTPreactor>> pool;
+    inline static std::mutex poolMutex;
+    inline static unsigned next = 0;
+
+    void wait(int timeout);
+    void wakeup(void);
+    void runTask();
+
+public:
+    HTTPreactor(void);
+    ~HTTPreactor(void);
+    void attach(reactorHandler* handler);
+    void detach(reactorHandler* handler);
+    void watch(int sock, reactorHandler* handler, int events);
+    void unwatch(int sock);
+    void notify(reactorHandler* handler);
+    // only from the reactor's thread (i.e. from a callback)
+    void tick(reactorHandler* handler, bool enable);
+    void lock(void) { mutex.lock(); }
+    void unlock(void) { mutex.unlock(); }
+    bool async(void);
+    bool send(reactorHandler* handler, int sock, struct msghdr* msg);
+    int registerBuffer(const void* base, size_t size);
+    void unregisterBuffer(int index);
+    inline static bool useUring = false;
+    static HTTPreactor* get(void);
+    static void closeAll(void);
+};
+
+bool setNonBlocking(int sock);
+bool wouldBlock(void);
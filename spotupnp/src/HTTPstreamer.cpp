@@ -4,17 +4,21 @@
  *
  */
 
+#include <cassert>
 #include <memory>
 #include <vector>
 #include <inttypes.h>
-#include <sstream>
-#include <regex>
+#include <charconv>
+#include <cstdarg>
 #include <algorithm>
 #include <atomic>
 #include <string>
+#include <filesystem>
+#include <tuple>
 #ifndef _WIN32
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #else
 #include <ws2tcpip.h>
@@ -29,95 +33,127 @@
 #define closesocket(s) close(s)
 #endif
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
 /****************************************************************************************
- * Ring buffer (always rolls over)
+ * Cache buffer
  */
 
-ringBuffer::ringBuffer(size_t size) : cacheBuffer(size) {
-    buffer = new uint8_t[size];
-    this->write_p = this->read_p = buffer;
-    this->wrap = buffer + size;
-}
-
-ssize_t ringBuffer::scope(size_t offset) {
+ssize_t cacheBuffer::scope(size_t offset) {
     if (offset >= total) return offset - total + 1;
     else if (offset >= total - level()) return 0;
     else return offset - total + level();
 }
 
-void ringBuffer::setOffset(size_t offset) {
-    if (offset >= total) read_p = write_p;
-    else if (offset < total - level()) read_p = (write_p + 1) == wrap ? buffer : write_p + 1;
-    else read_p = buffer + offset % size;
+/****************************************************************************************
+ * Ring buffer (always rolls over)
+ */
+
+ringBuffer::ringBuffer(size_t size) : cacheBuffer(size) {
+#ifdef __linux__
+    // map the same memory twice back-to-back so that nothing is ever split at wrap
+    size_t page = sysconf(_SC_PAGESIZE);
+    this->size = size = (size + page - 1) / page * page;
+    int fd = memfd_create("spotupnp-cache", MFD_CLOEXEC);
+
+    if (fd >= 0 && ftruncate(fd, size) == 0) {
+        uint8_t* base = (uint8_t*) mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base != MAP_FAILED &&
+            mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED &&
+            mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED) {
+            buffer = base;
+            mirrored = true;
+        } else if (base != MAP_FAILED) {
+            munmap(base, 2 * size);
+        }
+    }
+
+    if (fd >= 0) close(fd);
+    if (!mirrored) CSPOT_LOG(info, "can't mirror ring buffer, using split copies (%s)", strerror(errno));
+#endif
+    if (!mirrored) buffer = new uint8_t[size];
+    this->write_p = buffer;
+    this->wrap = buffer + size;
 }
 
-size_t ringBuffer::read(uint8_t* dst, size_t size, size_t min) {
-    size = std::min(size, pending());
-    if (size < min) return 0;
+ringBuffer::~ringBuffer(void) {
+#ifdef __linux__
+    if (mirrored) munmap(buffer, 2 * size);
+#endif
+    if (!mirrored) delete[] buffer;
+}
 
-    size_t cont = std::min(size, (size_t) (wrap - read_p));
-    memcpy(dst, read_p, cont);
-    memcpy(dst + cont, buffer, size - cont);
+std::shared_ptr<byteBuffer> ringBuffer::share(size_t capacity) {
+    // what producer can write ahead is not part of the cache anymore
+    reserved = std::min(capacity, size / 2);
+    shared = std::make_shared<byteBuffer>(buffer, size, reserved, mirrored);
+    return shared;
+}
 
-    read_p += size;
-    if (read_p >= wrap) read_p -= this->size;
-    return size;
+void ringBuffer::flush(void) {
+    write_p = buffer;
+    total = 0;
+    // producer must restart aligned with us
+    if (shared) shared->reset();
 }
 
-uint8_t* ringBuffer::readInner(size_t& size) {
-    // caller *must* consume ALL data
-    size = std::min(size, pending());
-    size = std::min(size, (size_t)(wrap - read_p));
+uint8_t* ringBuffer::readInner(cursor& at, size_t& size) {
+    at.offset = std::clamp(at.offset, total - level(), total);
+    size = std::min(size, total - at.offset);
 
-    uint8_t* p = read_p;
+    uint8_t* p = buffer + at.offset % this->size;
+    if (!mirrored) size = std::min(size, (size_t)(wrap - p));
 
-    read_p += size;
-    if (read_p >= wrap) read_p -= this->size;
+    at.offset += size;
     return size ? p : NULL;
 }
 
 void ringBuffer::write(const uint8_t* src, size_t size) {
-    size_t cont = std::min(size, (size_t)(wrap - write_p));
-    memcpy(write_p, src, cont);
-    memcpy(buffer, src + cont, size - cont);
+    // no need to copy when producer has written data in our memory
+    if (src != write_p) {
+        size_t cont = mirrored ? size : std::min(size, (size_t)(wrap - write_p));
+        memcpy(write_p, src, cont);
+        memcpy(buffer, src + cont, size - cont);
+    }
 
     write_p += size;
     total += size;
 
-    if (write_p >= wrap) write_p -= this->size;   
-    if (level() == this->size - 1) read_p = (write_p + 1 == wrap) ? buffer : write_p + 1;
+    if (write_p >= wrap) write_p -= this->size;
 }
 
 /****************************************************************************************
  * File buffer
  */
 
-size_t fileBuffer::read(uint8_t* dst, size_t size, size_t min) {
-    size = std::min(size, total);
-    if (size < min) return 0;
-   
-    fseek(file, readOffset, SEEK_SET);
-    size_t bytes = fread(dst, 1, size, file);
-    readOffset += bytes;
-
-    return bytes;
+#ifdef _WIN32
+fileBuffer::fileBuffer(size_t size) : cacheBuffer(size) {
+    file = tmpfile();
+    if (!file) throw std::runtime_error("can't create cache file " + std::string(strerror(errno)));
 }
 
-uint8_t* fileBuffer::readInner(size_t& size) {
-    if (size > this->size) {
-        delete[] buffer;
-        buffer = new uint8_t[size];
-        this->size = size;
-    }
+fileBuffer::~fileBuffer(void) {
+    fclose(file);
+}
 
-    // caller *must* consume ALL data
-    size = std::min(size, total);
+uint8_t* fileBuffer::readInner(cursor& at, size_t& size) {
+    // data is copied in reader's memory, so it stays until its next read
+    at.offset = std::min(at.offset, total);
+    size = std::min(size, total - at.offset);
+    if (at.scratch.size() < size) at.scratch.resize(size);
 
-    fseek(file, readOffset, SEEK_SET);
-    size = fread(buffer, 1, size, file);
-    readOffset += size;
+    fseek(file, at.offset, SEEK_SET);
+    size = fread(at.scratch.data(), 1, size, file);
+    at.offset += size;
 
-    return size ? buffer : NULL;
+    return size ? at.scratch.data() : NULL;
 }
 
 void fileBuffer::write(const uint8_t* src, size_t size) {
@@ -125,27 +161,478 @@ void fileBuffer::write(const uint8_t* src, size_t size) {
     fwrite(src, 1, size, file);
     total += size;
 }
+#else
+static int openCacheFile(void) {
+    std::string dir = fileBuffer::path;
+    if (dir.empty()) dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    int fd = -1;
+
+    // file is never visible (or deleted right away), so nothing is left behind on crash
+#ifdef O_TMPFILE
+    fd = open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+#endif
+    if (fd < 0) {
+        std::string name = dir + "/spotupnp-XXXXXX";
+        fd = mkstemp(name.data());
+        if (fd >= 0) unlink(name.c_str());
+    }
+
+    if (fd < 0) throw std::runtime_error("can't create cache file in " + dir + " " + std::string(strerror(errno)));
+    return fd;
+}
+
+fileBuffer::fileBuffer(size_t size) : cacheBuffer(size) {
+    fd = openCacheFile();
+    buffer = NULL;
+    this->size = 0;
+}
+
+fileBuffer::~fileBuffer(void) {
+    if (buffer) munmap(buffer, mapped);
+    for (auto& [base, length] : retired) munmap(base, length);
+    close(fd);
+}
+
+void fileBuffer::grow(size_t size) {
+    // double the (sparse) file so that we don't remap too often
+    size_t length = mapped ? mapped : 8 * 1024 * 1024;
+    while (length < size) length *= 2;
+
+    if (ftruncate(fd, length)) {
+        CSPOT_LOG(error, "can't extend cache file to %zu (%s)", length, strerror(errno));
+        return;
+    }
+
+    // readers might still be sending from the old map
+    if (buffer) retired.emplace_back(buffer, mapped);
+    buffer = (uint8_t*) mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (buffer == MAP_FAILED) {
+        CSPOT_LOG(error, "can't map cache file of %zu (%s)", length, strerror(errno));
+        buffer = NULL;
+        mapped = 0;
+    } else {
+        mapped = this->size = length;
+    }
+}
+
+uint8_t* fileBuffer::readInner(cursor& at, size_t& size) {
+    at.offset = std::min(at.offset, total);
+    size = std::min(size, total - at.offset);
+    if (!size || !buffer) return NULL;
+
+    uint8_t* p = buffer + at.offset;
+    at.offset += size;
+
+    return p;
+}
+
+#ifdef __linux__
+int fileBuffer::readFile(cursor& at, size_t& offset, size_t& size) {
+    at.offset = std::min(at.offset, total);
+    size = std::min(size, total - at.offset);
+    if (!size) return -1;
+
+    offset = at.offset;
+    at.offset += size;
+    return fd;
+}
+#endif
+
+void fileBuffer::write(const uint8_t* src, size_t size) {
+    if (total + size > mapped) grow(total + size);
+
+    // use write, not the map, so that a full disk is an error and not a SIGBUS
+    for (size_t done = 0; done < size;) {
+        ssize_t bytes = pwrite(fd, src + done, size - done, total + done);
+        if (bytes <= 0) {
+            CSPOT_LOG(error, "can't write cache file at %zu (%s)", total + done, strerror(errno));
+            break;
+        }
+        done += bytes;
+    }
+
+    total += size;
+}
+
+/****************************************************************************************
+ * Tiered buffer
+ */
+
+tieredBuffer::tieredBuffer(size_t size, std::function<void()> onSpilled) : cacheBuffer(size), ring(size), onSpilled(onSpilled) {
+    fd = openCacheFile();
+    spiller = std::thread(&tieredBuffer::spill, this);
+}
+
+tieredBuffer::~tieredBuffer(void) {
+    {
+        std::scoped_lock lock(mutex);
+        running = false;
+    }
+    cv.notify_all();
+    spiller.join();
+    close(fd);
+}
+
+void tieredBuffer::spill(void) {
+    std::unique_lock lock(mutex);
+
+    while (true) {
+        cv.wait(lock, [this] { return !running || spilled < written; });
+        if (!running) return;
+
+        // ring can't roll over that until we say it has been spilled (and it does not move)
+        size_t from = spilled, to = std::min(written, from + 1024 * 1024), length;
+        uint8_t* base = ring.memory(length);
+        busy = true;
+        lock.unlock();
+
+        for (size_t done = from; done < to;) {
+            size_t pos = done % length;
+            ssize_t bytes = pwrite(fd, base + pos, std::min(to - done, length - pos), done);
+            if (bytes <= 0) {
+                CSPOT_LOG(error, "can't spill cache at %zu (%s)", done, strerror(errno));
+                break;
+            }
+            done += bytes;
+        }
+
+        lock.lock();
+        spilled = to;
+        busy = false;
+        cv.notify_all();
+
+        // someone might be waiting for the ring to move
+        lock.unlock();
+        onSpilled();
+        lock.lock();
+    }
+}
+
+uint8_t* tieredBuffer::readInner(cursor& at, size_t& size) {
+    size_t oldest = this->oldest();
+    if (at.offset >= oldest) return ring.readInner(at, size);
+
+    // this is not in memory anymore but it is on disk
+    size = std::min(size, oldest - at.offset);
+    if (at.scratch.size() < size) at.scratch.resize(size);
+    ssize_t bytes = pread(fd, at.scratch.data(), size, at.offset);
+    if (bytes <= 0) return NULL;
+
+    size = bytes;
+    at.offset += size;
+    return at.scratch.data();
+}
+
+#ifdef __linux__
+int tieredBuffer::readFile(cursor& at, size_t& offset, size_t& size) {
+    size_t oldest = this->oldest();
+    if (at.offset >= oldest) return -1;
+
+    size = std::min(size, oldest - at.offset);
+    offset = at.offset;
+    at.offset += size;
+    return fd;
+}
+#endif
+
+void tieredBuffer::write(const uint8_t* src, size_t size) {
+    ring.write(src, size);
+    total = ring.total;
+
+    std::scoped_lock lock(mutex);
+    written = total;
+    cv.notify_one();
+}
+
+void tieredBuffer::flush(void) {
+    // wait for spiller to be done with what it is copying
+    std::unique_lock lock(mutex);
+    cv.wait(lock, [this] { return !busy; });
+
+    ring.flush();
+    total = written = spilled = 0;
+    if (ftruncate(fd, 0)) CSPOT_LOG(error, "can't truncate cache file (%s)", strerror(errno));
+}
+#endif
+
+/****************************************************************************************
+ * Track buffer and track cache
+ */
+
+uint8_t* trackBuffer::readInner(cursor& at, size_t& size) {
+    at.offset = std::min(at.offset, total);
+    size = std::min(size, total - at.offset);
+
+    uint8_t* p = buffer + at.offset;
+    at.offset += size;
+    return size ? p : NULL;
+}
+
+void trackCache::open(const std::string& path, size_t capacity) {
+    std::scoped_lock lock(mutex);
+    std::error_code ec;
+    trackCache::path = path;
+    diskCapacity = capacity;
+    closing = false;
+    files.clear();
+    diskUsed = 0;
+
+    if (path.empty()) return;
+
+    if (std::filesystem::create_directories(path, ec); ec) {
+        CSPOT_LOG(error, "can't use track cache directory %s (%s)", path.c_str(), ec.message().c_str());
+        trackCache::path.clear();
+        return;
+    }
+
+    // what was being written when we stopped is useless, the rest is ordered by last use
+    std::vector<std::tuple<std::filesystem::file_time_type, std::string, size_t>> found;
+    for (auto& item : std::filesystem::directory_iterator(path, ec)) {
+        auto extension = item.path().extension();
+        if (extension == ".tmp") std::filesystem::remove(item.path(), ec);
+        else if (extension == ".trk") found.emplace_back(item.last_write_time(ec), item.path().filename().string(), item.file_size(ec));
+    }
+
+    std::sort(found.begin(), found.end(), std::greater<>());
+    for (auto& [time, name, size] : found) {
+        // beyond capacity (it might have changed), oldest are deleted
+        if (diskUsed + size > diskCapacity) {
+            std::filesystem::remove(std::filesystem::path(path) / name, ec);
+        } else {
+            files.emplace_back(name, size);
+            diskUsed += size;
+        }
+    }
+
+    CSPOT_LOG(info, "track cache in %s has %zu tracks (%zu MB)", path.c_str(), files.size(), diskUsed / (1024 * 1024));
+}
+
+bool trackCache::accepts(size_t size) {
+    std::scoped_lock lock(mutex);
+    return size <= capacity || (!path.empty() && size <= diskCapacity);
+}
+
+std::shared_ptr<trackCache::entry> trackCache::get(const std::string& id, int64_t start) {
+    if (id.empty()) return nullptr;
+
+    // a stream that starts elsewhere in the track is a different one
+    std::string key = id + "@" + std::to_string(start), name, dir;
+
+    {
+        std::scoped_lock lock(mutex);
+
+        // most recently used are in front
+        if (auto it = std::find_if(tracks.begin(), tracks.end(), [&key](auto& track) { return track.first == key; }); it != tracks.end()) {
+            tracks.splice(tracks.begin(), tracks, it);
+            return it->second;
+        }
+
+        if (path.empty()) return nullptr;
+
+        name = fileName(key);
+        auto it = std::find_if(files.begin(), files.end(), [&name](auto& file) { return file.first == name; });
+        if (it == files.end()) return nullptr;
+        files.splice(files.begin(), files, it);
+        dir = path;
+    }
+
+    // reading a file can take a while, don't prevent others to use memory
+    auto track = load(key, dir, name);
+    if (!track) return nullptr;
+
+    std::scoped_lock lock(mutex);
+    insert(key, track);
+    return track;
+}
+
+void trackCache::put(const std::string& id, int64_t start, std::shared_ptr<entry> track) {
+    std::string key = id + "@" + std::to_string(start);
+    std::scoped_lock lock(mutex);
+
+    insert(key, track);
+    if (path.empty() || closing || track->data.size() > diskCapacity) return;
+
+    // mark it as being on disk already so that it's only written once
+    auto name = fileName(key);
+    if (std::find_if(files.begin(), files.end(), [&name](auto& file) { return file.first == name; }) != files.end()) return;
+    files.emplace_front(name, 0);
+
+    // whoever publishes must not wait for disk, but close() waits for writers
+    writers++;
+    std::thread(store, key, path, track).detach();
+}
+
+void trackCache::close(void) {
+    std::unique_lock lock(mutex);
+    // what is being written is discarded, no file can be renamed once we return
+    closing = true;
+    idle.wait(lock, [] { return !writers; });
+}
+
+void trackCache::insert(const std::string& key, std::shared_ptr<entry> track) {
+    // mutex must be locked
+    for (auto it = tracks.begin(); it != tracks.end(); ++it) {
+        if (it->first != key) continue;
+        used -= it->second->data.size();
+        tracks.erase(it);
+        break;
+    }
+
+    if (track->data.size() > capacity) return;
+
+    tracks.emplace_front(key, track);
+    used += track->data.size();
+
+    while (used > capacity) {
+        used -= tracks.back().second->data.size();
+        tracks.pop_back();
+    }
+}
+
+std::string trackCache::fileName(const std::string& key) {
+    // FNV-1a, keys are short and they are checked when loading anyway
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (auto c : key) hash = (hash ^ (uint8_t) c) * 0x100000001b3ULL;
+
+    char name[24];
+    snprintf(name, sizeof(name), "%016" PRIx64 ".trk", hash);
+    return name;
+}
+
+std::shared_ptr<trackCache::entry> trackCache::load(const std::string& key, const std::string& dir, const std::string& name) {
+    auto fullName = std::filesystem::path(dir) / name;
+    FILE* file = fopen(fullName.string().c_str(), "rb");
+
+    // it might still be being written
+    if (!file) return nullptr;
+
+    auto track = std::make_shared<entry>();
+    char magic[8];
+    uint32_t length;
+    uint64_t size;
+    std::string stored;
+
+    bool valid = fread(magic, sizeof(magic), 1, file) == 1 && !memcmp(magic, "SPOTTRK1", 8) &&
+                 fread(&length, sizeof(length), 1, file) == 1 && length == key.size() &&
+                 (stored.resize(length), fread(stored.data(), length, 1, file) == 1) && stored == key &&
+                 track->index.load(file) && fread(&size, sizeof(size), 1, file) == 1 && size < SIZE_MAX / 2 &&
+                 (track->data.resize(size), fread(track->data.data(), 1, size, file) == size);
+    fclose(file);
+
+    if (valid) {
+        // so that last use survives restarts
+        std::error_code ec;
+        std::filesystem::last_write_time(fullName, std::filesystem::file_time_type::clock::now(), ec);
+        CSPOT_LOG(info, "track %s loaded from %s (%zu bytes)", key.c_str(), name.c_str(), track->data.size());
+        return track;
+    }
+
+    // either damaged or another key with same hash, it's not worth keeping
+    CSPOT_LOG(info, "track cache file %s is not usable for %s, deleting", name.c_str(), key.c_str());
+    std::scoped_lock lock(mutex);
+    if (path != dir) return nullptr;
+    if (auto it = std::find_if(files.begin(), files.end(), [&name](auto& file) { return file.first == name; }); it != files.end()) {
+        diskUsed -= it->second;
+        files.erase(it);
+    }
+    std::error_code ec;
+    std::filesystem::remove(fullName, ec);
+    return nullptr;
+}
+
+void trackCache::store(const std::string& key, const std::string& dir, std::shared_ptr<entry> track) {
+    std::string name = fileName(key);
+    auto fullName = std::filesystem::path(dir) / name, tmpName = fullName;
+    tmpName.replace_extension(".tmp");
+
+    // file only gets its name once fully written, so whatever happens it's complete or absent
+    FILE* file = fopen(tmpName.string().c_str(), "wb");
+    uint32_t length = key.size();
+    uint64_t size = track->data.size();
+
+    bool done = file && fwrite("SPOTTRK1", 8, 1, file) == 1 && fwrite(&length, sizeof(length), 1, file) == 1 &&
+                fwrite(key.data(), length, 1, file) == 1 && track->index.save(file) &&
+                fwrite(&size, sizeof(size), 1, file) == 1 && fwrite(track->data.data(), 1, size, file) == size &&
+                fflush(file) == 0;
+#ifndef _WIN32
+    done = done && fsync(fileno(file)) == 0;
+#endif
+    if (file) fclose(file);
+
+    std::scoped_lock lock(mutex);
+    std::error_code ec;
+    auto it = std::find_if(files.begin(), files.end(), [&name](auto& file) { return file.first == name; });
+
+    // cache has been closed or re-opened in the meantime, renaming is done under lock so that
+    // it never happens once close() has returned
+    if (closing || path != dir || it == files.end()) {
+        std::filesystem::remove(tmpName, ec);
+    } else if (done && (std::filesystem::rename(tmpName, fullName, ec), !ec)) {
+        it->second = size;
+        diskUsed += size;
+
+        // least recently used go first but not the one we just wrote, which is not always
+        // in front as others might have been used while it was being written
+        for (auto victim = files.end(); diskUsed > diskCapacity && victim != files.begin();) {
+            if (--victim == it) continue;
+            std::filesystem::remove(std::filesystem::path(path) / victim->first, ec);
+            diskUsed -= victim->second;
+            victim = files.erase(victim);
+        }
+    } else {
+        CSPOT_LOG(error, "can't store track %s in %s (%s)", key.c_str(), name.c_str(), ec ? ec.message().c_str() : strerror(errno));
+        std::filesystem::remove(tmpName, ec);
+        files.erase(it);
+    }
+
+    writers--;
+    idle.notify_all();
+}
+
+/****************************************************************************************
+ * DLNA normal play time, either H+:MM:SS.mmm or S+.mmm (we always send the former)
+ */
+
+static const char* nptFormat(char* buffer, uint32_t ms) {
+    sprintf(buffer, "%u:%02u:%02u.%03u", ms / 3600000, (ms / 60000) % 60, (ms / 1000) % 60, ms % 1000);
+    return buffer;
+}
+
+static bool nptParse(std::string_view npt, uint32_t& ms) {
+    uint32_t seconds = 0;
+
+    for (int fields = 0;; fields++) {
+        uint32_t value;
+        auto [end, ec] = std::from_chars(npt.data(), npt.data() + npt.size(), value);
+        if (ec != std::errc() || fields > 2) return false;
+        seconds = seconds * 60 + value;
+        npt.remove_prefix(end - npt.data());
+        if (npt.empty() || npt[0] != ':') break;
+        npt.remove_prefix(1);
+    }
+
+    // only milliseconds are relevant
+    ms = seconds * 1000;
+    if (!npt.empty() && npt[0] == '.') {
+        for (size_t i = 1, scale = 100; i < npt.size() && isdigit(npt[i]); i++, scale /= 10) ms += (npt[i] - '0') * scale;
+    }
+
+    return true;
+}
 
 /****************************************************************************************
  * Class to stream audio content with HTTP
  */
 
 HTTPstreamer::HTTPstreamer(struct in_addr addr, std::string id, unsigned index, std::string codec, 
-                           bool flow, int64_t contentLength, int cacheMode, 
-                           cspot::TrackInfo trackInfo, std::string_view trackUnique, int32_t startOffset,
-                           onHeadersHandler onHeaders, EoSCallback onEoS) :
-                           trackUnique(trackUnique), flow(flow), trackInfo(trackInfo), cacheMode(cacheMode), 
-                           bell::Task("HTTP streamer", 32 * 1024, 0, 0) {
+                           bool flow, int cacheMode, onHeadersHandler onHeaders, EoSCallback onEoS) :
+                           reactor(HTTPreactor::get()), listener(HTTPlistener::get(addr)),
+                           codec(codec), flow(flow), cacheMode(cacheMode) {
     this->streamId = id + "_" + std::to_string(index);
-    this->listenSock = socket(AF_INET, SOCK_STREAM, 0);
     this->host = std::string(inet_ntoa(addr));
     this->onHeaders = onHeaders;
     this->onEoS = onEoS;
-    this->icy.interval = 0;
-    // for flow mode, start with a negative offset so that we can always substract
-    this->offset = startOffset;
-    if (cacheMode == HTTP_CACHE_DISK && !flow) this->cache = std::make_unique<fileBuffer>();
-    else this->cache = std::make_unique<ringBuffer>();
 
     codecSettings settings;
 
@@ -159,6 +646,11 @@ HTTPstreamer::HTTPstreamer(struct in_addr addr, std::string id, unsigned index,
     } else if (codec.find("opus") != std::string::npos) {
         (void)!sscanf(codec.c_str(), "%*[^:]:%d", &settings.opus.bitrate);
         encoder = createCodec(codecSettings::OPUS, settings);
+    } else if (codec.find("ogg") != std::string::npos || codec.find("passthrough") != std::string::npos) {
+        // what we are fed is Spotify's Ogg pages, bitrate is only for estimating length
+        (void)!sscanf(codec.c_str(), "%*[^:]:%d", &settings.vorbis.bitrate);
+        encoder = createCodec(codecSettings::OGG, settings);
+        passthrough = true;
     } else if (codec.find("vorbis") != std::string::npos) {
         (void)!sscanf(codec.c_str(), "%*[^:]:%d", &settings.vorbis.bitrate);
         encoder = createCodec(codecSettings::VORBIS, settings);
@@ -170,45 +662,136 @@ HTTPstreamer::HTTPstreamer(struct in_addr addr, std::string id, unsigned index,
         encoder = createCodec(codecSettings::MP3, settings);
     } else throw std::runtime_error("unknown codec");
 
-    // now estimate the content-length
-    setContentLength(contentLength);
+    this->index = std::make_shared<seekIndex>();
+    encoder->setIndex(this->index);
+    // encoding is done by workers, wake-up streamer if it has nothing to send
+    encoder->onEncoded = [this] { if (waiting.exchange(false)) reactor->notify(this); };
+
+    // codec is set-up now, track only tells how long it will be
+    makeCache();
+    encoder->prepare();
 
     scratchLen = flow ? encoder->icyInterval : 16384;
-    scratch = new uint8_t[scratchLen];
-  
-    struct sockaddr_in host;
-    host.sin_addr = addr;
-    host.sin_family = AF_INET;
 
-    for (int count = 0, offset = rand();; count++, offset++) {
-        host.sin_port = htons(portBase + (offset % portRange));
-        if (!bind(listenSock, (const sockaddr*) &host, sizeof(host))) break;
-        if (!portBase || count == portRange) throw std::runtime_error("can't bind on port" + std::string(strerror(errno)));
+    // connections are routed to us as soon as we are known, they'll wait until we start
+    this->streamUrl = "http://" + this->host + ":" + std::to_string(listener->getPort()) + HTTP_BASE_URL + "." + this->encoder->id() + "?id=" + this->streamId;
+    listener->add(streamId, this);
+}
+
+void HTTPstreamer::assign(cspot::TrackInfo trackInfo, std::string_view trackUnique, int32_t startOffset, int64_t contentLength) {
+    this->trackInfo = trackInfo;
+    this->trackUnique = trackUnique;
+    // for flow mode, start with a negative offset so that we can always substract
+    this->offset = startOffset;
+
+    // a track that has already been encoded the same way does not need to be encoded again
+    if (!flow && !trackInfo.trackId.empty()) cacheKey = trackInfo.trackId + "/" + codec;
+
+    if (auto track = trackCache::get(cacheKey, -offset); track) {
+        // encoder must stop using cache's memory before it goes
+        encoder->setOutput(std::make_shared<byteBuffer>());
+        this->track = track;
+        this->index->assign(track->index);
+        int64_t header = this->index->headerSize();
+        if (header > 0) memcpy(streamHeader, track->data.data(), std::min((size_t) header, sizeof(streamHeader)));
+        this->cache = std::make_unique<trackBuffer>(track->data);
+        totalOut = cache->total;
+        attached = true;
+        state = DRAINING;
+        CSPOT_LOG(info, "serving %s at %" PRId64 " from track cache (%zu bytes)", cacheKey.c_str(), -offset, cache->total);
     }
 
-    socklen_t len = sizeof(host);
-    getsockname(listenSock, (struct sockaddr*) &host, &len);
-    this->port = ntohs(host.sin_port);
-    CSPOT_LOG(info, "Bound to port %u", this->port);
+    // now estimate the content-length
+    setContentLength(contentLength);
+
+    // DLNA features never change, so format them once
+    // infinite mode is memory only but it claims otherwise (players rarely go back that far)
+    bool fullCache = cacheMode == HTTP_CACHE_INFINITE || cache->capacity() == SIZE_MAX;
+    char* DLNA_ORG = makeDLNA_ORG(encoder->id().c_str(), fullCache, flow);
+    dlnaFeatures = DLNA_ORG;
+    free(DLNA_ORG);
+}
 
-    this->streamUrl = "http://" + this->host + ":" + std::to_string(this->port) + HTTP_BASE_URL + "." + this->encoder->id() + "?id=" + this->streamId;
+void HTTPstreamer::makeCache(void) {
+    cache.reset();
 
-    if (::listen(listenSock, 1) < 0) {
-        throw std::runtime_error("listen failed on port " +
-            std::to_string(this->port) + ": " +
-            std::string(strerror(errno)));
+    if (cacheMode == HTTP_CACHE_DISK && !flow) {
+        try {
+            cache = std::make_unique<fileBuffer>();
+        } catch (std::exception& e) {
+            CSPOT_LOG(error, "disk cache unavailable, using memory (%s)", e.what());
+        }
+    }
+#ifndef _WIN32
+    else if (cacheMode == HTTP_CACHE_TIERED || cacheMode == HTTP_CACHE_DISK) {
+        // whole history is spilled to disk (flow might last for hours), only recent data is in memory
+        try {
+            auto tiered = std::make_unique<tieredBuffer>(12 * 1024 * 1024, [this] { if (blocked) reactor->notify(this); });
+            encoder->setOutput(tiered->share(4 * 1024 * 1024));
+            cache = std::move(tiered);
+        } catch (std::exception& e) {
+            CSPOT_LOG(error, "tiered cache unavailable, using memory only (%s)", e.what());
+        }
+    }
+#endif
+
+    // encoder writes directly in memory cache, so add what it can hold to what we keep
+    if (!cache) {
+        auto ring = std::make_unique<ringBuffer>(12 * 1024 * 1024);
+        encoder->setOutput(ring->share(4 * 1024 * 1024));
+        cache = std::move(ring);
     }
 }
 
 HTTPstreamer::~HTTPstreamer() {
     isRunning = false;
-    std::scoped_lock lock(runningMutex);
-    if (listenSock > 0) closesocket(listenSock);
-    delete[] scratch;
-    CSPOT_LOG(info, "HTTP streamer %s deleted", streamId.c_str());
+    // after that, neither listener nor reactor will ever call us again
+    listener->remove(streamId, this);
+    reactor->detach(this);
+    // nobody can re-schedule encoder anymore, so once it is not running it never will
+    encodePool::cancel(encoder.get(), true);
+    reactor->unregisterBuffer(bufferIndex);
+    for (auto& [sock, c] : connections) closesocket(sock);
+    for (auto& [sock, request] : accepted) closesocket(sock);
+    CSPOT_LOG(info, "HTTP streamer %s deleted (%u requests over %u connections)", streamId.c_str(), requests, accepts);
+}
+
+void HTTPstreamer::start(void) {
+    size_t size;
+    isRunning = true;
+
+    // cache memory can be used by the kernel without copy
+    if (auto base = cache->memory(size); base && reactor->async()) bufferIndex = reactor->registerBuffer(base, size);
+
+    reactor->attach(this);
+    // pick up connections that have been handed over before we were attached
+    reactor->notify(this);
+}
+
+bool HTTPstreamer::matchUrl(std::string_view url) {
+    // player might decorate the url but all streamers share the port, so xxx_1 is not xxx_12
+    auto pos = url.find(streamUrl);
+    return pos != std::string::npos && (pos + streamUrl.size() == url.size() || !isdigit(url[pos + streamUrl.size()]));
+}
+
+void HTTPstreamer::handoff(int sock, std::string request) {
+    {
+        std::scoped_lock lock(acceptMutex);
+        accepted.emplace_back(sock, std::move(request));
+    }
+    reactor->notify(this);
+}
+
+void HTTPstreamer::drain(void) {
+    // a track served from track cache might already be fully sent
+    if (state != DRAINED) state = DRAINING;
+    reactor->notify(this);
 }
 
 void HTTPstreamer::setContentLength(int64_t contentLength) {
+    // codec writes headers in encoded data that reactor (or a worker) might be using
+    std::scoped_lock lock(*reactor);
+    encodePool::cancel(encoder.get());
     // a real content-length (< 0 means estimated) might be provided by codec (offset is negative)
     uint64_t duration = trackInfo.duration - (-offset);
     int64_t length = encoder->initialize(duration);
@@ -219,6 +802,9 @@ void HTTPstreamer::setContentLength(int64_t contentLength) {
     if (contentLength == HTTP_CL_REAL) this->contentLength = length < 0 && duration ? abs(length) * 1.20 : abs(length);
     else if (contentLength == HTTP_CL_KNOWN) this->contentLength = length > 0 ? length : HTTP_CL_NONE;
     else this->contentLength = contentLength;
+
+    // a track from track cache has an exact length
+    if (attached && (contentLength == HTTP_CL_REAL || contentLength == HTTP_CL_KNOWN)) this->contentLength = cache->total - base + lead;
 }
 
 void HTTPstreamer::getMetadata(metadata_t* metadata) {
@@ -233,105 +819,112 @@ void HTTPstreamer::getMetadata(metadata_t* metadata) {
 }
 
 void HTTPstreamer::flush() {
-    totalOut = 0;
+    // make sure neither reactor nor a worker is using us
+    std::scoped_lock lock(*reactor);
+    encodePool::cancel(encoder.get());
+    totalIn = totalOut = 0;
+    base = lead = skip = timeBase = 0;
+    resumed = published = exhausted = false;
     state = OFF;
+    // what we'll be fed is not the cached track anymore, so we need our own cache again
+    if (attached) {
+        attached = false;
+        makeCache();
+    }
     cache->flush();
     encoder->flush();
-    icy.trackId.clear();
-}
-
-bool HTTPstreamer::connect(int sock) {
-    auto data = std::vector<uint8_t>();
-
-    // get the HTTP headers by chunks (there should be no body)
-    while (1) {
-        uint8_t buffer[256];
-        int n = recv(sock, (char*) buffer, sizeof(buffer), 0);
 
-        if (n <= 0)  return false;
-
-        data.insert(data.end(), buffer, buffer + n);
-        if (data.size() >= 4 && !memcmp(data.data() + data.size() - 4, "\r\n\r\n", 4)) break;
+    for (auto& [sock, c] : connections) {
+        c->at.offset = 0;
+        c->icy.trackId.clear();
     }
+}
 
-    // regex to remove leading and trailing spaces
-    std::regex expr("^\\s+|\\s+$");
-    size_t offset = 0;
-
-    auto nextLine = [&data, &offset](void) {
-        uint8_t* start, * end;
-        std::string line;
-        end = start = data.data() + offset;
-
-        // find eol
-        for (end = start = data.data() + offset;
-             offset < data.size() && *end != '\r' && *end != '\n';
-             end++, offset++);
-
-        if (offset < data.size()) {
-            line = std::string(start, end);
-            for (; (*end == '\r' || *end == '\n') && offset < data.size(); end++, offset++);
-        }
-
-        return line;
-    };
+bool HTTPstreamer::seek(uint32_t position) {
+    // make sure reactor is not using us
+    std::scoped_lock lock(*reactor);
+
+    // where we are in stream (offset is where current resource starts in track)
+    int64_t ms = (int64_t) position + offset + timeBase;
+    // what we've been fed is not PCM so we can't tell where cache is, source must restart
+    if (passthrough) return false;
+    if (flow || ms < 0 || (!attached && (state == DRAINING || state == DRAINED))) return false;
+
+    // we need to have that frame and player needs headers (we're still encoding, so skip what's already done)
+    int64_t at = index->offsetAt(ms), header = index->headerSize();
+    uint64_t done = (uint64_t) ms * 44100 / 1000 * 4;
+    if (at < 0 || cache->scope(at) != 0 || header > (int64_t) sizeof(streamHeader) || (!attached && done > totalIn)) return false;
+
+    // a resource that starts right after headers is just the whole stream
+    size_t newBase = at == header ? 0 : at, newLead = at == header ? 0 : header;
+    if (contentLength > 0) contentLength += (int64_t) (base - lead) - (int64_t) (newBase - newLead);
+
+    // player restarts at that frame which is not exactly what was asked
+    uint32_t time = index->timeAt(at);
+    offset -= (int64_t) time - timeBase;
+    timeBase = time;
+    base = newBase;
+    lead = newLead;
+    skip = attached ? 0 : totalIn - done;
+    // even if we are drained by then, player must be able to get it once
+    resumed = true;
+
+    CSPOT_LOG(info, "seeking in cache at %u ms (offset:%zu cached:%zu skip:%zu)", time, base, cache->total, skip);
+    return true;
+}
 
-    auto dump = std::string((char*)data.data(), data.size());
-    CSPOT_LOG(info, "HTTP received =>\n%s", dump.c_str());
+bool HTTPstreamer::connect(connection& c) {
+    auto& rx = c.rx;
+    CSPOT_LOG(info, "HTTP received =>\n%.*s", (int) rx.raw().size(), rx.raw().data());
 
-    // get the streamId 
-    auto request = nextLine();
+    c.keepAlive = false;
+    requests++;
 
-    if (request.find("?id=") == std::string::npos) {
-        CSPOT_LOG(error, "Incorrect HTTP request, can't find streamId %s", request.c_str());
+    // get the streamId, which runs till the end of the query's parameter (as in listener)
+    auto pos = rx.parse() ? rx.target.find("?id=") : std::string_view::npos;
+    if (pos == std::string_view::npos) {
+        CSPOT_LOG(error, "Incorrect HTTP request, can't find streamId %.*s", (int) rx.target.size(), rx.target.data());
         return false;
     }
 
-    // check this is what's expected
-    if (request.find(streamId) == std::string::npos) {
-        CSPOT_LOG(info, "Wrong client/request %s not in  url %s", streamId.c_str(), request.c_str());
+    // check this is what's expected, the whole of it
+    auto id = rx.target.substr(pos + 4, rx.target.find('&', pos) - pos - 4);
+    if (id != streamId) {
+        CSPOT_LOG(info, "Wrong client/request %s not in  url %.*s", streamId.c_str(), (int) rx.target.size(), rx.target.data());
         return false;
     }
 
-    HTTPheaders response, headers;
-
-    // parse headers
-    for (auto line = nextLine(); !line.empty(); line = nextLine()) {
-        size_t pos = line.find(':');
-        if (pos == std::string::npos) continue;
-        for (auto it = line.begin(); it != line.end(); ++it) *it = tolower(*it);
-        headers[std::regex_replace(line.substr(0, pos), expr, "")] = std::regex_replace(line.substr(pos + 1), expr, "");
+    // get optional headers from whoever wants to have a say (only then we need a map)
+    HTTPheaders response;
+    if (onHeaders) {
+        HTTPheaders headers;
+        rx.forEach([&headers](std::string_view name, std::string_view value) {
+            std::string key(name);
+            for (auto& c : key) c = tolower(c);
+            headers[key] = value;
+        });
+        response = onHeaders(headers);
     }
 
-    // get optional headers from whoever wants to have a say
-    if (onHeaders) response = onHeaders(headers);
-
-    std::string status = "200 OK";
-    chunked = request.find("HTTP/1.1") != std::string::npos && contentLength == HTTP_CL_CHUNKED;
-
-    bool sendBody = request.find("HEAD") == std::string::npos;
-    bool isSonos = headers["user-agent"].find("sonos") != std::string::npos;
+    const char* status = "200 OK";
+    bool http11 = rx.version == "HTTP/1.1";
+    bool chunked = http11 && contentLength == HTTP_CL_CHUNKED;
+
+    bool isHead = rx.method == "HEAD";
+    bool sendBody = !isHead, extra = true;
+    bool isSonos = requestParser::contains(rx.header("user-agent"), "sonos");
+    char contentRange[96] = "", timeRange[128] = "";
+    uint32_t seek;
+    // stream's headers to send before body (a copy)
+    size_t leadFrom = 0, leadTo = 0;
+    // after a seek in cache, what player sees starts with stream's headers followed by cache from base
+    size_t end = cache->total - base + lead;
     // if we know the real length because it's a redo, then tell it if authorized
-    int64_t length = (state == DRAINED && (contentLength >= 0 || contentLength == HTTP_CL_KNOWN)) ? totalOut : contentLength;
+    int64_t length = (state == DRAINED && (contentLength >= 0 || contentLength == HTTP_CL_KNOWN)) ? totalOut - base + lead : contentLength;
     
     // check if icy metadata is requested
-    if (auto it = headers.find("icy-metadata"); it != headers.end() && flow) {
-       icy.remain = icy.interval = std::max(scratchLen, encoder->icyInterval);
-       response["icy-metaint"] = std::to_string(icy.interval);
-    }
-
-    // check various DLNA fields
-    if (auto it = headers.find("transferMode.dlna.org"); it != headers.end()) response["transferMode.dlna.org"] = it->second;
-    if (auto it = headers.find("getcontentFeatures.dlna.org"); it != headers.end()) {
-        char* DLNA_ORG = makeDLNA_ORG(encoder->id().c_str(), cacheMode != HTTP_CACHE_MEM, flow);
-        response["contentFeatures.dlna.org"] = DLNA_ORG;
-        free(DLNA_ORG);
-    }
-    if (auto it = headers.find("getAvailableSeekRange.dlna.org"); it != headers.end() && cache->total) {
-        response["contentFeatures.dlna.org"] = "availableSeekRange.dlna.org: 0 bytes=" +
-                                               std::to_string(cache->total - (cacheMode == HTTP_CACHE_MEM ? cache->level() : 0)) +
-                                               "-" + std::to_string(cache->total - 1);
-    }
+    c.icy.interval = 0;
+    if (rx.header("icy-metadata").data() && flow) c.icy.remain = c.icy.interval = std::max(scratchLen, encoder->icyInterval);
 
     /* There is a fair bit of HTTP soup below and the problem is many Sonos speakers. When paused
      * (on mp3 or flac) they will leave the connection open, then close and and re-open it on 
@@ -343,148 +936,298 @@ bool HTTPstreamer::connect(int sock) {
      * compliant) or they fail as well */
 
     // by default, use cache and restart from oldest (might change that below)
-    useCache = true;
-    cache->setOffset(0);
+    c.at.offset = base;
 
     // handle range-request 
-    if (auto it = headers.find("range"); it != headers.end() && cache->total) {
+    if (auto range = rx.header("range"); range.data() && cache->total) {
         size_t offset = 0;
-        (void) !sscanf(it->second.c_str(), "bytes=%zu", &offset);
+        if (range.substr(0, 6) == "bytes=") std::from_chars(range.data() + 6, range.data() + range.size(), offset);
 
         // this is not an initial request (there is cache), so if offset is 0, we are all set
         if (offset) {
-            if (state != DRAINED && cache->total == offset) {
+            // where that is in cache (headers are always available)
+            size_t from = offset < lead ? base : base + offset - lead;
+            if (state != DRAINED && end == offset) {
                 // special case where we just continue so we'll do a 200 with no cache
-                useCache = false;
-            } else if (cache->scope(offset) == 0) {
+                c.at.offset = cache->total;
+            } else if (offset < end && cache->scope(from) == 0) {
                 // first try to see if we can serve that
                 status = "206 Partial Content";
                 // see note above
-                if (!isSonos) response["Content-Range"] = "bytes " + std::to_string(offset) + 
-                                                          "-" + std::to_string(cache->total - 1) + "/*";
+                if (!isSonos) snprintf(contentRange, sizeof(contentRange), "bytes %zu-%zu/*", offset, end - 1);
                 // do not sent content-length on PartialResponse
-                cache->setOffset(offset);
-                CSPOT_LOG(info, "service partial-content %zu-%zu (length:%" PRId64 ")", offset, cache->total - 1, length);
+                c.at.offset = from;
+                if (offset < lead) leadFrom = offset, leadTo = lead;
+                CSPOT_LOG(info, "service partial-content %zu-%zu (length:%" PRId64 ")", offset, end - 1, length);
                 length = 0;
-            } else if (state == DRAINED && offset >= cache->total) {
+            } else if (state == DRAINED && offset >= end) {
                 // there is an offset out of scope and we are drained, we are tapping in estimated length
-                sendBody = false;
+                sendBody = extra = false;
                 status = "416 Range Not Satisfiable";
-                response.clear();
-                response["Content-Range"] = "bytes */" + std::to_string(cache->total);
-                CSPOT_LOG(info, "can't serve offset %zu (cached:%zu)", offset, cache->total);
+                snprintf(contentRange, sizeof(contentRange), "bytes */%zu", end);
+                CSPOT_LOG(info, "can't serve offset %zu (cached:%zu)", offset, end);
+            } else if (length <= (int64_t) offset || cache->total == base) {
+                // no (or too short) announced length, a tail can't be made up, nor without any cache
+                sendBody = extra = false;
+                status = "416 Range Not Satisfiable";
+                if (length > 0) snprintf(contentRange, sizeof(contentRange), "bytes */%" PRId64, length);
+                CSPOT_LOG(info, "can't serve probe at %zu (length:%" PRId64 " cached:%zu)", offset, length, end);
             } else {
                 // this likely means we are being probed toward the end of the file (which we don't have)
                 status = "206 Partial Content";
-                size_t avail = std::min(cache->total, (size_t) (length - offset));
-                cache->setOffset(cache->total - avail);
-                response["Content-Range"] = "bytes " + std::to_string(offset) +
-                    "-" + std::to_string(offset + avail - 1) + "/" + std::to_string(length);
+                size_t avail = std::min(cache->total - base, (size_t) (length - offset));
+                c.at.offset = cache->total - avail;
+                snprintf(contentRange, sizeof(contentRange), "bytes %zu-%zu/%" PRId64, offset, offset + avail - 1, length);
                 CSPOT_LOG(info, "being probed at %zu but have %zu/%" PRId64 ", using offset at %zu", offset,
-                                 cache->total, length, cache->total - avail);
+                                 end, length, end - avail);
                 length = 0;
             }
-        } else if (state == DRAINED) {
-            sendBody = false;
+        } else if (state == DRAINED && !resumed) {
+            sendBody = extra = false;
             status = "410 Gone";
-            response.clear();
             CSPOT_LOG(info, "won't resend from start when already fully served");
+        } else {
+            if (cache->scope(base) == 0) leadTo = lead;
+            resumed = false;
         }
-    } else if (state == DRAINED) {
-        sendBody = false;
+    } else if (auto npt = rx.header("TimeSeekRange.dlna.org"); npt.substr(0, 4) == "npt=" &&
+               nptParse(npt.substr(4), seek) && (seek || cache->total)) {
+        // we can only seek where we have already encoded, starting at a frame boundary
+        int64_t offset = index->offsetAt(seek + timeBase), header = index->headerSize();
+        if (offset >= 0 && cache->scope(offset) == 0) {
+            char nptStart[16], nptEnd[16];
+            int64_t duration = trackInfo.duration + this->offset;
+            nptFormat(nptStart, index->timeAt(offset) - timeBase);
+
+            // decoders need headers, so send a copy first unless they are right before (and cached)
+            if (offset == header && cache->scope(0) == 0) offset = 0;
+            else if (header <= (int64_t) sizeof(streamHeader)) leadTo = header;
+
+            // time-seek is answered with a 200 and once drained, we know exactly what's left
+            if (state == DRAINED) {
+                length = cache->total - offset + leadTo;
+                snprintf(timeRange, sizeof(timeRange), "npt=%s-%s/%s", nptStart,
+                         nptFormat(nptEnd, index->timeAt(cache->total) - timeBase), nptEnd);
+            } else {
+                length = 0;
+                if (flow || duration <= 0) snprintf(timeRange, sizeof(timeRange), "npt=%s-/*", nptStart);
+                else snprintf(timeRange, sizeof(timeRange), "npt=%s-%s/%s", nptStart, nptFormat(nptEnd, duration), nptEnd);
+            }
+
+            c.at.offset = offset;
+            CSPOT_LOG(info, "time-seek at %u ms from offset %" PRId64 " (cached:%zu)", seek, offset, cache->total);
+        } else {
+            sendBody = extra = false;
+            status = "416 Range Not Satisfiable";
+            CSPOT_LOG(info, "can't time-seek at %u ms (cached:%zu)", seek, cache->total);
+        }
+    } else if (state == DRAINED && !resumed) {
+        sendBody = extra = false;
         status = "410 Gone";
-        response.clear();
         CSPOT_LOG(info, "won't resend from start when already fully served");
     } else if (cache->total) {
         // restart from the beginning if we have cache (see note above regarding Sonos)
         if (isSonos) length = INT64_MAX;
-        CSPOT_LOG(info, "service with cache from %zu (cached:%zu)", cache->total - cache->level(), cache->total);
+        if (cache->scope(base) == 0) leadTo = lead;
+        resumed = false;
+        CSPOT_LOG(info, "service with cache from %zu (cached:%zu)", std::max(base, cache->total - cache->level()), cache->total);
     } else {
         // initial request, don't use cache (there is non anyway)
-        useCache = false;
+        c.at.offset = cache->total;
     }
 
-    // c++ conversion to string is really a joke
-    std::stringstream responseStr;
-    responseStr << (chunked ? "HTTP/1.1 " : "HTTP/1.0 ") + status + "\r\n";
-    
-    if (sendBody) {
-        if (length > 0) {
-            chunked = false;
-            responseStr << "Content-Length: " + std::to_string(length) + "\r\n";
-        } else if (chunked) {
-            responseStr << "Transfer-Encoding: chunked\r\n";
+    if (sendBody && length > 0) chunked = false;
+
+    /* Connection can only be re-used when the end of response is clear, which is when there 
+     * is no body or when it is chunked. Content-length is most of the time an estimation, so 
+     * we can't rely on it and without any length, only closing tells where the body ends */
+    c.keepAlive = http11 && !requestParser::contains(rx.header("connection"), "close") && (!sendBody || chunked);
+
+    // response is written directly where it will be sent from
+    auto& head = c.head;
+    head.clear();
+    head.add("%s %s\r\n", chunked || c.keepAlive ? "HTTP/1.1" : "HTTP/1.0", status);
+
+    if (sendBody && length > 0) head.add("Content-Length: %" PRId64 "\r\n", length);
+    else if (sendBody && chunked) head.add("Transfer-Encoding: chunked\r\n");
+    else if (!sendBody && !isHead) head.add("Content-Length: 0\r\n");
+    if (*contentRange) head.add("Content-Range: %s\r\n", contentRange);
+    if (*timeRange) head.add("TimeSeekRange.dlna.org: %s\r\n", timeRange);
+
+    // optional headers are not sent with errors
+    if (extra) {
+        for (auto& [key, value] : response) head.add("%s: %s\r\n", key.c_str(), value.c_str());
+        if (c.icy.interval) head.add("icy-metaint: %zu\r\n", c.icy.interval);
+
+        // check various DLNA fields
+        if (auto mode = rx.header("transferMode.dlna.org"); mode.data()) {
+            head.add("transferMode.dlna.org: %.*s\r\n", (int) mode.size(), mode.data());
+        }
+        if (rx.header("getcontentFeatures.dlna.org").data()) head.add("contentFeatures.dlna.org: %s\r\n", dlnaFeatures.c_str());
+        if (rx.header("getAvailableSeekRange.dlna.org").data() && cache->total) {
+            size_t first = cache->total - cache->level();
+            uint32_t start, last;
+            first = first > base ? first - base + lead : 0;
+            // time range is what index knows of cached data
+            if (index->span(start, last)) {
+                char nptStart[16], nptEnd[16];
+                last = std::max(last, (uint32_t) index->timeAt(cache->total));
+                head.add("availableSeekRange.dlna.org: 0 npt=%s-%s bytes=%zu-%zu\r\n", nptFormat(nptStart, std::max(start, timeBase) - timeBase),
+                         nptFormat(nptEnd, last - timeBase), first, end - 1);
+            } else {
+                head.add("availableSeekRange.dlna.org: 0 bytes=%zu-%zu\r\n", first, end - 1);
+            }
         }
     }
 
-    // send accumulated headers
-    for (auto it = response.cbegin(); it != response.cend(); ++it) responseStr << it->first + ": " + it->second + "\r\n";
-    responseStr << "Server: spot-connect\r\n";
-    responseStr << "Accept-Ranges: bytes\r\n";
-    responseStr << "Content-Type: " + encoder->mimeType + "\r\n";
-    responseStr << "Connection: close\r\n";
-    responseStr << "\r\n";
-    
-    send(sock, responseStr.str().c_str(), responseStr.str().size(), 0);
-    CSPOT_LOG(info, "HTTP response =>\n%s", responseStr.str().c_str());
+    head.add("Server: spot-connect\r\n");
+    head.add("Accept-Ranges: bytes\r\n");
+    head.add("Content-Type: %s\r\n", encoder->mimeType.c_str());
+    head.add(c.keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+
+    c.sendBody = sendBody;
+    c.chunked = chunked;
+    c.floor = SIZE_MAX;
+    c.tx.push(head.data, head.size);
+    CSPOT_LOG(info, "HTTP response =>\n%.*s", (int) head.size, head.data);
+
+    if (sendBody && leadTo > leadFrom) {
+        queueChunk(c, streamHeader + leadFrom, leadTo - leadFrom);
+        if (c.icy.interval) c.icy.remain -= leadTo - leadFrom;
+    }
 
     return sendBody;
 }
 
-ssize_t HTTPstreamer::sendChunk(int sock, uint8_t* data, ssize_t size, bool count) {
-    if (chunked) {
+void HTTPstreamer::queueChunk(connection& c, const uint8_t* data, size_t size) {
+    if (c.chunked) {
         char chunk[16];
-        sprintf(chunk, "%zx\r\n", size);
-        if (send(sock, chunk, strlen(chunk), 0) < 0) return 0;
+        int len = snprintf(chunk, sizeof(chunk), "%zx\r\n", size);
+        c.tx.copy(chunk, len);
     }
 
-    ssize_t bytes = size;
+    c.tx.push(data, size);
+    if (c.chunked) c.tx.push("\r\n", 2);
 
-    while (bytes) {
-        ssize_t sent = send(sock, (char*) data + size - bytes, bytes, 0);
-        // might be chunked mode, but no reason to send and end-of-chunk
-        if (sent < 0) return size - bytes;
-        bytes -= sent;
+    c.sent += size;
+}
+
+void HTTPstreamer::queueFile(connection& c, int fd, size_t offset, size_t size) {
+    if (c.chunked) {
+        char chunk[16];
+        int len = snprintf(chunk, sizeof(chunk), "%zx\r\n", size);
+        c.tx.copy(chunk, len);
     }
 
-    if (chunked) {
-        send(sock, "\r\n", 2, 0);
+    c.tx.pushFile(fd, offset, size);
+    if (c.chunked) c.tx.push("\r\n", 2);
+
+    c.sent += size;
+}
+
+bool HTTPstreamer::fill(void) {
+    size_t size = scratchLen;
+    // a track from track cache is already complete
+    if (attached) return !(exhausted = true);
+
+    // encoder runs on its own, so it must be done *before* we find nothing to read
+    bool drained = encoder->isDrained();
+    uint8_t* data = encoder->readSpan(size, state == DRAINING);
+    blocked = false;
+    exhausted = !data && drained;
+
+    if (!data) {
+        // encoder is done, others might want that track
+        if (exhausted && state == DRAINING && !published) publish();
+        return false;
     }
 
-    if (count) totalOut += size;
-    return size;
+    // what falls out of memory might be overwritten, so nobody must be still using it
+    size_t oldest = cache->total + size - std::min(cache->total + size, cache->window());
+    if (cache->pinned() < oldest) return !(blocked = true);
+    for (auto& [sock, c] : connections) {
+        if (!c->tx.empty() && c->floor < oldest) return !(blocked = true);
+    }
+
+    // once cached, encoder's data is not needed anymore (it's a no-copy when memory is shared)
+    // keep what is before first frame (which is not known until a frame has been encoded)
+    if (int64_t header = index->headerSize(); cache->total < sizeof(streamHeader) && (header < 0 || cache->total < (size_t) header)) {
+        size_t bytes = std::min(size, sizeof(streamHeader) - cache->total);
+        memcpy(streamHeader + cache->total, data, header < 0 ? bytes : std::min(bytes, (size_t) header - cache->total));
+    }
+
+    cache->write(data, size);
+    encoder->commitRead(size);
+    totalOut += size;
+    index->trim(cache->total - cache->level());
+
+    return true;
 }
 
-ssize_t HTTPstreamer::streamBody(int sock, struct timeval& timeout) {
-    ssize_t size = 0;
+void HTTPstreamer::publish(void) {
+    published = true;
+
+    // only a whole track, from where it was meant to start, can be re-used
+    uint64_t fed = totalIn * 1000 / (44100 * 4);
+    if (passthrough || cacheKey.empty() || attached || base || timeBase || cache->scope(0) || !trackCache::accepts(cache->total) ||
+        (int64_t) fed + 1000 < (int64_t) trackInfo.duration + offset) return;
 
-    // cache has priority
-    if (useCache) {
-        size = cache->read(scratch, scratchLen);
-        if (!size) useCache = false;
+    auto track = std::make_shared<trackCache::entry>();
+    track->data.resize(cache->total);
+    track->index.assign(*index);
+
+    for (cacheBuffer::cursor at; at.offset < cache->total;) {
+        size_t from = at.offset, size = cache->total - from;
+        uint8_t* data = cache->readInner(at, size);
+        if (!data) return;
+        memcpy(track->data.data() + from, data, size);
     }
 
-    // not using cache or empty cache, get fresh data from encoder
-    if (!size) {
-        size = encoder->read(scratch, scratchLen, 0, state == DRAINING);
-        // cache what we have anyway
-        cache->write(scratch, size);
+    trackCache::put(cacheKey, -offset, track);
+    CSPOT_LOG(info, "track %s at %" PRId64 " is in track cache (%zu bytes)", cacheKey.c_str(), -offset, cache->total);
+}
+
+bool HTTPstreamer::streamBody(connection& c) {
+    // this reader has caught up, so it is the one bringing fresh data
+    if (c.at.offset >= cache->total && !fill()) return false;
+
+    uint8_t* data = NULL;
+    size_t offset, size = 1024 * 1024;
+
+    // disk cache is sent by the kernel, so large chunks are cheap (no ICY or io_uring then)
+    if (int fd = c.icy.interval || reactor->async() ? -1 : cache->readFile(c.at, offset, size); fd >= 0) {
+        c.floor = SIZE_MAX;
+        queueFile(c, fd, offset, size);
+        return true;
     }
 
+    // data is sent in-place, queue is always empty here
+    c.floor = c.at.offset;
+
+    size = scratchLen;
+    data = cache->readInner(c.at, size);
+
     // we really have nothing, let caller decide what's next
-    if (!size) {
-        timeout.tv_usec = 50 * 1000;
-        return 0;
+    if (!data) return false;
+
+    if (size < scratchLen && !c.icy.interval) {
+        // we might have stopped at ring's wrap, so queue what's after it for the same send
+        size_t more = scratchLen - size;
+        if (uint8_t* next = cache->readInner(c.at, more); next) {
+            queueChunk(c, data, size);
+            data = next;
+            size = more;
+        }
     }
 
-    int offset = 0;
+    offset = 0;
 
     // check if ICY sending is active (len < ICY_INTERVAL)
-    if (icy.interval && size > icy.remain) {
+    if (c.icy.interval && size > c.icy.remain) {
         int len_16 = 0;
         char buffer[255*16+1];
             
-        if (icy.trackId != trackInfo.trackId) {
+        if (c.icy.trackId != trackInfo.trackId) {
             const char* format, *artist = trackInfo.artist.c_str();
                 
             // there is room for 1 extra byte at the beginning for length
@@ -493,121 +1236,550 @@ ssize_t HTTPstreamer::streamBody(int sock, struct timeval& timeout) {
             len_16 = snprintf(buffer, sizeof(buffer), format, artist, *artist ? " - " : "", trackInfo.name.c_str(), trackInfo.imageUrl.c_str()) - 1;
             len_16 = (len_16 + 15) / 16;
 
-            icy.trackId = trackInfo.trackId;
+            c.icy.trackId = trackInfo.trackId;
             CSPOT_LOG(info, "ICY update %s", buffer + 1);
         }
 
         buffer[0] = len_16;
 
         // send remaining data first
-        offset = icy.remain;
-        if (offset) sendChunk(sock, (uint8_t*)scratch, offset, !useCache);
+        offset = c.icy.remain;
+        if (offset) queueChunk(c, data, offset);
         size -= offset;
 
-        // then send icy data
-        sendChunk(sock, (uint8_t*) buffer, len_16 * 16 + 1, false);
-        icy.remain = icy.interval;
+        // then send icy data (it's small, so copy it)
+        if (c.chunked) {
+            char chunk[16];
+            c.tx.copy(chunk, snprintf(chunk, sizeof(chunk), "%x\r\n", len_16 * 16 + 1));
+        }
+        c.tx.copy(buffer, len_16 * 16 + 1);
+        if (c.chunked) c.tx.push("\r\n", 2);
+        c.icy.remain = c.icy.interval;
     }
 
-    ssize_t sent = sendChunk(sock, (uint8_t*) scratch + offset, size, !useCache);
+    queueChunk(c, data + offset, size);
     
     // update remaining count with desired length
-    if (icy.interval) icy.remain -= size;
-
-    if (sent != size) {
-#ifdef _WIN32
-        int error = WSAGetLastError();
-#else
-        int error = errno;
-#endif
-        CSPOT_LOG(error, "HTTP error %d for %s => send %zd / %zd (%d)", error, streamId.c_str(), sent, size, sock);
-        return sent - size;
-    }
+    if (c.icy.interval) c.icy.remain -= size;
 
-    timeout.tv_usec = 0;   
-    return size;
+    return true;
 }
 
 bool HTTPstreamer::feedPCMFrames(const uint8_t* data, size_t size) {
-    if (isRunning && encoder->pcmWrite(data, size)) {
+    // a passthrough encoder only takes Ogg pages
+    if (passthrough) return false;
+
+    // track is served from track cache, so what we are sent is already there
+    if (attached) {
         totalIn += size;
+        return isRunning;
+    }
+
+    // after a seek in cache, we are sent again what has already been encoded
+    size_t skipped = std::min(skip, size);
+
+    if (isRunning && (size == skipped || encoder->pcmWrite(data + skipped, size - skipped))) {
+        skip -= skipped;
+        totalIn += size - skipped;
+        // wake-up streamer only if it has nothing to send
+        if (waiting.exchange(false)) reactor->notify(this);
         return true;
     } else {
         return false;
     }
 }
 
-void HTTPstreamer::runTask() {
-    std::scoped_lock lock(runningMutex);
-    isRunning = true;
+bool HTTPstreamer::feedOggPages(const uint8_t* data, size_t size) {
+    // pages can be cut anywhere, encoder re-frames them
+    if (!passthrough || !isRunning || !encoder->pcmWrite(data, size)) return false;
 
-    int sock = -1;
-    struct timeval timeout = { 0, 25 * 1000 };
+    totalIn += size;
+    if (waiting.exchange(false)) reactor->notify(this);
+    return true;
+}
+
+void HTTPstreamer::disconnect(connection& c) {
+    // second time is when kernel is done with a stale connection
+    if (!c.tx.stale) {
+        auto elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - c.acceptTime).count();
+        CSPOT_LOG(info, "HTTP %s sent %" PRIu64 " pieces in %" PRIu64 " syscalls (%.0f saved per minute)", streamId.c_str(),
+                         c.tx.pieces, c.tx.syscalls, elapsed > 0 ? (c.tx.pieces - c.tx.syscalls) * 60 / elapsed : 0.0f);
+        reactor->unwatch(c.sock);
+    }
 
-    while (isRunning) {
-        fd_set rfds;
-        bool success = true;
+    // kernel might still be sending, socket is closed once it's done so that it's not re-used
+    if (c.tx.busy) {
+        shutdown(c.sock, SHUT_RDWR);
+        c.tx.stale = true;
+        return;
+    }
 
-        if (sock == -1) {
-            struct timeval timeout = { 0, 50 * 1000 };
+    closesocket(c.sock);
+    connections.erase(c.sock);
 
-            FD_ZERO(&rfds);
-            FD_SET(listenSock, &rfds);
+    // we can accept a new connection
+    std::scoped_lock lock(acceptMutex);
+    if (!accepted.empty()) reactor->notify(this);
+}
 
-            if (select(listenSock + 1, &rfds, NULL, NULL, &timeout) > 0) {
-                sock = accept(listenSock, NULL, NULL);
+bool HTTPstreamer::accept(void) {
+    std::unique_ptr<connection> c;
+
+    {
+        // don't let a misbehaving player open too many, others are waiting in line
+        std::scoped_lock lock(acceptMutex);
+        if (accepted.empty() || connections.size() >= 4) return false;
+        c = std::make_unique<connection>();
+        c->sock = accepted.front().first;
+        c->rx.append(accepted.front().second.data(), accepted.front().second.size());
+        accepted.pop_front();
+    }
+
+    CSPOT_LOG(info, "got HTTP connection %u (%zu active)", c->sock, connections.size() + 1);
+    accepts++;
+    c->acceptTime = std::chrono::steady_clock::now();
+    reactor->watch(c->sock, this, READ);
+    connections[c->sock] = std::move(c);
+
+    return true;
+}
+
+void HTTPstreamer::onEvent(int sock, int events) {
+    auto it = connections.find(sock);
+    if (it == connections.end()) return;
+    auto& c = *it->second;
+
+    if (events & READ) {
+        ssize_t n = 0;
+        size_t space;
+
+        // receive directly in parser's buffer (space must be known before recv() is called)
+        while (!c.rx.full()) {
+            char* dst = c.rx.space(space);
+            if ((n = recv(sock, dst, space, 0)) <= 0) break;
+            c.rx.commit(n);
+        }
+
+        // terminate connection if required by HTTP peer (or if it is sending garbage)
+        if (n == 0 || (n < 0 && !wouldBlock()) || c.rx.full()) {
+            CSPOT_LOG(info, "HTTP close %u (sent:%zu)", sock, c.sent);
+            // we might be left with nobody to stream to
+            if (state == STREAMING && connections.size() == 1) state = CONNECTING;
+            disconnect(c);
+            return;
+        }
+    }
+
+    pump(c);
+}
+
+void HTTPstreamer::onNotify(void) {
+    // connections might be waiting, listener might already have received the whole request
+    while (accept());
+
+    // only needed when we are waiting for encoded data or for a new connection
+    for (auto it = connections.begin(); it != connections.end();) {
+        auto& c = *(it++)->second;
+        if (c.tx.empty()) pump(c);
+    }
+}
+
+void HTTPstreamer::onSent(int sock, ssize_t result) {
+    auto it = connections.find(sock);
+    if (it == connections.end()) return;
+    auto& c = *it->second;
+
+    c.tx.busy = false;
+
+    if (c.tx.stale) {
+        // connection was closed in-between, nothing was watching the socket
+        c.tx.clear();
+        disconnect(c);
+        return;
+    } else if (result < 0) {
+        CSPOT_LOG(error, "HTTP error %d for %s, early closing socket %d (sent:%zu)", (int) -result, streamId.c_str(), sock, c.sent);
+        c.tx.clear();
+        disconnect(c);
+        return;
+    }
+
+    c.tx.sent(result);
+    // someone might be waiting for us to release the cache
+    if (c.tx.empty() && blocked) reactor->notify(this);
+
+    pump(c);
+}
+
+void HTTPstreamer::pump(connection& c) {
+    int sock = c.sock;
+
+    while (true) {
+        // first send whatever is pending
+        if (!c.tx.empty()) {
+            // kernel is sending, we'll be called back
+            if (c.tx.busy) return;
+            if (reactor->async() && c.tx.submit(reactor, this, sock)) return;
+
+            if (c.tx.send(sock) < 0) {
+#ifdef _WIN32
+                int error = WSAGetLastError();
+#else
+                int error = errno;
+#endif
+                // something happened, let's close the socket and wait for next request
+                CSPOT_LOG(error, "HTTP error %d for %s, early closing socket %d (sent:%zu)", error, streamId.c_str(), sock, c.sent);
+                disconnect(c);
+                return;
+            }
+
+            // socket is full, wait till it is writable
+            if (!c.tx.empty()) {
+                reactor->watch(sock, this, READ | WRITE);
+                return;
             }
 
-            if (sock == -1 || !isRunning) continue;
-            CSPOT_LOG(info, "got HTTP connection %u", sock);
+            // someone might be waiting for us to release the cache
+            if (blocked) reactor->notify(this);
         }
 
-        FD_ZERO(&rfds);
-        FD_SET(sock, &rfds);
+        // everything has been sent 
+        if (c.finishing) {
+            if (state == DRAINING && onEoS) onEoS(this);
+            state = DRAINED;
+            c.finishing = c.sendBody = false;
+
+            if (!c.keepAlive) {
+                CSPOT_LOG(info, "closing socket %d (sent:%zu), now lingering", sock, c.sent);
+                shutdown(sock, SHUT_RDWR);
+                disconnect(c);
+                return;
+            }
 
-        int n = select(sock + 1, &rfds, NULL, NULL, &timeout);
+            CSPOT_LOG(info, "response done on socket %d (sent:%zu), keeping it", sock, c.sent);
+        } else if (c.lingering) {
+            CSPOT_LOG(info, "HTTP close %u (sent:%zu)", sock, c.sent);
+            disconnect(c);
+            return;
+        }
 
-        if (n > 0) {
-            success = connect(sock);
+        // requests are served in order, once the previous response is complete
+        if (!c.sendBody && c.rx.complete()) {
+            bool success = connect(c);
+            c.rx.consume();
+            // measure how long it takes to get the first byte of body out
+            c.requestTime = std::chrono::steady_clock::now();
+            c.firstByte = success;
             // we might already be in draining mode
             if (success && state <= STREAMING) state = STREAMING;
-            else if (state == DRAINED) useCache = true;
+            // terminate connection once response has been sent, unless it can be re-used
+            if (!success && !c.keepAlive) c.lingering = true;
+            continue;
         }
 
-        // terminate connection if required by HTTP peer
-        if (n < 0 || (!success && state <= CONNECTING)) {
-            CSPOT_LOG(info, "HTTP close %u (sent:%zu)", sock, totalOut);
-            closesocket(sock);
-            sock = -1;
-            if (state == STREAMING) state = CONNECTING;
+        // try to stream some data 
+        bool streaming = c.sendBody && state >= STREAMING;
+        if (streaming && streamBody(c)) {
+            if (c.firstByte) {
+                auto elapsed = std::chrono::steady_clock::now() - c.requestTime;
+                CSPOT_LOG(info, "first byte for %s after %.1f ms", streamId.c_str(), 
+                                 std::chrono::duration<float, std::milli>(elapsed).count());
+                c.firstByte = false;
+            }
             continue;
         }
 
-        // try to stream some data 
-        ssize_t sent = state >= STREAMING || (state == DRAINED && useCache) ? streamBody(sock, timeout) : 0;
-
-        if (state >= DRAINING && !sent) {
-           // chunked-encoding terminates by a last empty chunk ending sequence
-           if (chunked) send(sock, "0\r\n\r\n", 5, 0);
-
-           CSPOT_LOG(info, "closing socket %d (sent:%zu), now lingering", sock, totalOut);
-           if (state == DRAINING && onEoS) onEoS(this);
-           state = DRAINED;      
-
-           shutdown(sock, SHUT_RDWR);
-           closesocket(sock);
-           sock = -1;
-        } else if (sent < 0) {
-            // something happened in streamBody, let's close the socket and wait for next request
-            CSPOT_LOG(info, "early closing socket %d (sent:%zu)", sock, totalOut);
-            closesocket(sock);
-            sock = -1;
+        if (streaming && blocked) {
+            // a late reader prevents new data to be cached, it will wake us up
+            reactor->watch(sock, this, READ);
+            return;
+        } else if (streaming && state >= DRAINING && exhausted) {
+            // chunked-encoding terminates by a last empty chunk ending sequence
+            if (c.chunked) c.tx.push("0\r\n\r\n", 5);
+            c.finishing = true;
+        } else if (streaming && !waiting.exchange(true)) {
+            // data might have arrived before feeder could see that we are waiting
+            continue;
         } else {
-            timeout.tv_usec = 50 * 1000;
+            // nothing to send, wait for data or for a new request
+            reactor->watch(sock, this, READ);
+            return;
         }
     }
+}
 
-    isRunning = false;
+/****************************************************************************************
+ * Spare streamer
+ */
+
+void streamerPool::build(void) {
+    std::unique_lock lock(mutex);
+
+    // quit when there is nothing to do, whoever frees a spare or asks for one restarts us
+    while (!pending.empty() && count < limit) {
+        auto pool = pending.front();
+        pending.pop_front();
+        building = pool;
+        count++;
+
+        // don't hold the lock while building, pool can't go away while it is being served
+        lock.unlock();
+        std::shared_ptr<HTTPstreamer> streamer;
+        try {
+            streamer = pool->make();
+        } catch (std::exception& e) {
+            CSPOT_LOG(error, "can't prepare spare streamer (%s)", e.what());
+        }
+        lock.lock();
+
+        building = nullptr;
+        if (streamer) pool->spare = streamer;
+        else count--;
+        cv.notify_all();
+    }
+
+    running = false;
+}
+
+void streamerPool::kick(void) {
+    // lock must be held
+    if (running || pending.empty() || count >= limit) return;
+    running = true;
+    std::thread(build).detach();
+}
+
+std::shared_ptr<HTTPstreamer> streamerPool::take(bool next) {
+    std::shared_ptr<HTTPstreamer> streamer;
+
+    {
+        std::unique_lock lock(mutex);
+        // a spare being built will be ready sooner than one made from scratch
+        cv.wait(lock, [this] { return building != this; });
+        streamer = std::move(spare);
+        if (streamer) count--;
+    }
+
+    // when builder could not make one (or never tried), whoever needs it will see why
+    if (!streamer) streamer = make();
+
+    std::scoped_lock lock(mutex);
+    if (next && std::find(pending.begin(), pending.end(), this) == pending.end()) pending.push_back(this);
+    // taken spare might also have made room for another pool
+    kick();
+    return streamer;
+}
+
+void streamerPool::release(void) {
+    // declared first so that spare is deleted once lock is released
+    std::shared_ptr<HTTPstreamer> streamer;
+    std::unique_lock lock(mutex);
+
+    pending.erase(std::remove(pending.begin(), pending.end(), this), pending.end());
+    cv.wait(lock, [this] { return building != this; });
+    streamer = std::move(spare);
+    if (streamer) count--;
+    kick();
+}
+
+/****************************************************************************************
+ * Request parser and response writer
+ */
+
+bool requestParser::append(const char* src, size_t size) {
+    if (size > sizeof(data) - used) return false;
+    memcpy(data + used, src, size);
+    used += size;
+    return true;
+}
+
+bool requestParser::complete(void) {
+    if (end) return true;
+
+    // only look at what is new (but an end marker might straddle previous data)
+    for (size_t i = scanned > 3 ? scanned - 3 : 0; i + 4 <= used; i++) {
+        if (data[i] == '\r' && !memcmp(data + i, "\r\n\r\n", 4)) {
+            end = i + 4;
+            return true;
+        }
+    }
+
+    scanned = used;
+    return false;
+}
+
+bool requestParser::parse(void) {
+    std::string_view text(data, end), line;
+    auto trim = [](std::string_view s) {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+        return s;
+    };
+    auto next = [&text](void) {
+        size_t pos = text.find("\r\n");
+        auto line = text.substr(0, pos);
+        text.remove_prefix(pos == std::string_view::npos ? text.size() : pos + 2);
+        return line;
+    };
+
+    // request line is method, target and version
+    line = next();
+    size_t first = line.find(' '), last = line.rfind(' ');
+    if (first == std::string_view::npos || first == last) return false;
+
+    method = line.substr(0, first);
+    target = line.substr(first + 1, last - first - 1);
+    version = line.substr(last + 1);
+
+    for (count = 0, line = next(); !line.empty() && count < sizeof(fields) / sizeof(*fields); line = next()) {
+        size_t pos = line.find(':');
+        if (pos == std::string_view::npos) continue;
+        fields[count].name = trim(line.substr(0, pos));
+        fields[count++].value = trim(line.substr(pos + 1));
+    }
+
+    return true;
+}
+
+void requestParser::consume(void) {
+    // there might be a pipelined request
+    memmove(data, data + end, used - end);
+    used -= end;
+    scanned = end = count = 0;
+    method = target = version = std::string_view();
+}
+
+std::string_view requestParser::header(std::string_view name) {
+    for (size_t i = 0; i < count; i++) {
+        if (equals(fields[i].name, name)) return fields[i].value;
+    }
+    return std::string_view();
+}
+
+bool requestParser::equals(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) { return tolower(x) == tolower(y); });
+}
+
+bool requestParser::contains(std::string_view s, std::string_view what) {
+    for (size_t i = 0; i + what.size() <= s.size(); i++) if (equals(s.substr(i, what.size()), what)) return true;
+    return false;
+}
+
+void responseWriter::add(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(data + size, sizeof(data) - size, format, args);
+    va_end(args);
+    // silently truncate, headers are way smaller than buffer
+    if (n > 0) size = std::min(size + n, sizeof(data) - 1);
+}
+
+/****************************************************************************************
+ * Send queue
+ */
+
+void sendQueue::push(const void* data, size_t size) {
+    if (!size) return;
+    // pump() only queues when queue is empty and a response or body step is at most 9 items
+    assert(count < std::size(items));
+    items[count].data = (const uint8_t*) data;
+    items[count].fd = -1;
+    items[count++].size = size;
+    pieces++;
+}
+
+void sendQueue::pushFile(int fd, size_t offset, size_t size) {
+    if (!size) return;
+    assert(count < std::size(items));
+    items[count].data = NULL;
+    items[count].fd = fd;
+    items[count].offset = offset;
+    items[count++].size = size;
+    pieces++;
+}
+
+void sendQueue::copy(const void* data, size_t size) {
+    size = std::min(size, sizeof(pad) - padUsed);
+    memcpy(pad + padUsed, data, size);
+    push(pad + padUsed, size);
+    padUsed += size;
+}
+
+#ifndef _WIN32
+void sendQueue::gather(void) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+
+    for (size_t i = index; i < count && items[i].fd < 0; i++) {
+        iov[msg.msg_iovlen].iov_base = (void*) items[i].data;
+        iov[msg.msg_iovlen++].iov_len = items[i].size;
+    }
+}
+#endif
+
+void sendQueue::advance(size_t bytes) {
+    // consume what has been sent, might be across items or partial
+    while (bytes) {
+        auto& item = items[index];
+        size_t len = std::min(bytes, item.size);
+        if (item.data) item.data += len;
+        item.size -= len;
+        bytes -= len;
+        if (!item.size) index++;
+    }
+
+    if (index == count) clear();
+}
+
+bool sendQueue::submit(HTTPreactor* reactor, reactorHandler* handler, int sock) {
+#ifndef _WIN32
+    // files are only sent synchronously
+    if (items[index].fd >= 0) return false;
+
+    gather();
+    busy = reactor->send(handler, sock, &msg);
+    if (busy) syscalls++;
+#endif
+    return busy;
+}
+
+ssize_t sendQueue::send(int sock) {
+    ssize_t total = 0;
+
+    while (index < count) {
+        ssize_t sent;
+        syscalls++;
+
+#ifdef __linux__
+        // sendfile() moves the offset by itself and 0 means file is shorter than expected
+        if (items[index].fd >= 0) {
+            sent = sendfile(sock, items[index].fd, &items[index].offset, items[index].size);
+            if (!sent) {
+                // what is queued can't be sent, so caller must close (and errno must say why)
+                errno = EIO;
+                return -1;
+            }
+        } else
+#endif
+        {
+#ifdef _WIN32
+            sent = ::send(sock, (const char*) items[index].data, items[index].size, 0);
+#else
+            int flags = 0;
+            gather();
+#ifdef MSG_MORE
+            // a file region follows, don't push a partial segment
+            if (index + msg.msg_iovlen < count) flags |= MSG_MORE;
+#endif
+            sent = sendmsg(sock, &msg, flags);
+#endif
+        }
+
+        if (sent < 0) return wouldBlock() ? total : -1;
+
+        total += sent;
+        advance(sent);
+    }
+
+    return total;
 }
 
 /* DLNA.ORG_CI: conversion indicator parameter (integer)
@@ -682,21 +1854,23 @@ char* makeDLNA_ORG(const char *codec, bool infiniteCache, bool live) {
      * don't have access to it until we have received full content. As it is supposed to
      * represent what is accessible, not the media itself, we'll always set it. We can still use
      * partial cache, so b29 shall be set (then OP shall not be). If user has opted-out file
-     * cache (or no fake), we can only do b29. In any case, we don't support time-based seek */
+     * cache (or no fake), we can only do b29. Time-based seek is served from the same cache
+     * (through the seek index), so it follows the same rules with OP's 'a' and b30 */
     
-     uint32_t org_op = infiniteCache ? DLNA_ORG_OPERATION_RANGE : 0;
+     uint32_t org_op = infiniteCache ? DLNA_ORG_OPERATION_RANGE | DLNA_ORG_OPERATION_TIMESEEK : 0;
      uint32_t org_flags = DLNA_ORG_FLAG_STREAMING_TRANSFERT_MODE | DLNA_ORG_FLAG_BACKGROUND_TRANSFERT_MODE |
                           DLNA_ORG_FLAG_CONNECTION_STALL | DLNA_ORG_FLAG_DLNA_V15 |
                           DLNA_ORG_FLAG_SN_INCREASE;
 
      if (live) org_flags |= DLNA_ORG_FLAG_S0_INCREASE;
-     if (!infiniteCache) org_flags |= DLNA_ORG_FLAG_BYTE_BASED_SEEK;
+     if (!infiniteCache) org_flags |= DLNA_ORG_FLAG_BYTE_BASED_SEEK | DLNA_ORG_FLAG_TIME_BASED_SEEK;
 
-     size_t n = snprintf(NULL, 0, "%sDLNA.ORG_OP=%02u;DLNA.ORG_CI=0;DLNA.ORG_FLAGS=%08x000000000000000000000000",
+     // OP is two binary digits, which is what hex of 0x10 and 0x01 gives
+     size_t n = snprintf(NULL, 0, "%sDLNA.ORG_OP=%02x;DLNA.ORG_CI=0;DLNA.ORG_FLAGS=%08x000000000000000000000000",
                               DLNAOrgPN, org_op, org_flags);
 
      char* DLNA = (char*) malloc(n + 1);
-     (void) !snprintf(DLNA, n + 1, "%sDLNA.ORG_OP=%02u;DLNA.ORG_CI=0;DLNA.ORG_FLAGS=%08x000000000000000000000000",
+     (void) !snprintf(DLNA, n + 1, "%sDLNA.ORG_OP=%02x;DLNA.ORG_CI=0;DLNA.ORG_FLAGS=%08x000000000000000000000000",
                                                  DLNAOrgPN, org_op, org_flags);
      return DLNA;
 }
@@ -7,18 +7,31 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <memory>
 #include <inttypes.h>
 #include <map>
 #include <functional>
+#include <deque>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <sys/socket.h>
+#endif
 
-#include "BellTask.h"
 #include "TrackQueue.h"
 #ifdef _WIN32
 #include "win32shim.h"
 #endif
 
 #include "HTTPmode.h"
+#include "HTTPreactor.h"
+#include "HTTPlistener.h"
 #include "metadata.h"
 #include "codecs.h"
 
@@ -42,86 +55,335 @@ protected:
 public:
     size_t total = 0;
 
+    // each reader has its own position, caches that can't read in-place use its scratch
+    struct cursor {
+        size_t offset = 0;
+        std::vector<uint8_t> scratch;
+    };
+
     cacheBuffer(size_t size) : size(size) { }
     virtual ~cacheBuffer(void) { };
-    virtual size_t level(void) = 0;
-    virtual size_t pending(void) = 0;
-    virtual ssize_t scope(size_t offset) = 0;
-    virtual size_t read(uint8_t* dst, size_t max, size_t min = 0) = 0;
-    virtual uint8_t* readInner(size_t& size) = 0;
-    virtual void setOffset(size_t offset) = 0;
+    // how much data is kept behind total and how much of it stays in-place
+    virtual size_t capacity(void) { return SIZE_MAX; }
+    virtual size_t window(void) { return capacity(); }
+    // oldest data that cache itself still needs in-place
+    virtual size_t pinned(void) { return SIZE_MAX; }
+    size_t level(void) { return std::min(total, capacity()); }
+    ssize_t scope(size_t offset);
+    // readers too late are moved to oldest data, data stays valid until it's out of level
+    virtual uint8_t* readInner(cursor& at, size_t& size) = 0;
+    // when data can be sent directly from a file, return its descriptor (or -1)
+    virtual int readFile(cursor& at, size_t& offset, size_t& size) { return -1; }
+    // when data is always in the same memory, return where it is
+    virtual uint8_t* memory(size_t& size) { return NULL; }
     virtual void write(const uint8_t* src, size_t size) = 0;
     virtual void flush(void) = 0;
 };
 
 /****************************************************************************************
- * Ring buffer (always rolls over)
+ * Ring buffer (always rolls over). When possible, memory is mapped twice in a row so that
+ * any read or write is contiguous, even across wrap. Memory can be shared with a producer
+ * that writes data in-place, ahead of what has been cached
  */
 class ringBuffer : public cacheBuffer {
 private:
-    uint8_t* read_p, * write_p, * wrap;
+    uint8_t* write_p, * wrap;
+    bool mirrored = false;
+    std::shared_ptr<byteBuffer> shared;
+    size_t reserved = 0;
 
 public:
     ringBuffer(size_t size = 8 * 1024 * 1024);
-    ~ringBuffer(void) { delete[] buffer; }
-    size_t level(void) { return total < size ? total : size - 1; }  
-    size_t pending(void) { return write_p >= read_p ? write_p - read_p : wrap - read_p; }
-    ssize_t scope(size_t offset);
-    size_t read(uint8_t* dst, size_t max, size_t min = 0);
-    uint8_t* readInner(size_t& size);
-    void setOffset(size_t offset);
+    ~ringBuffer(void);
+    std::shared_ptr<byteBuffer> share(size_t capacity);
+    uint8_t* memory(size_t& size) { size = this->size; return buffer; }
+    size_t capacity(void) { return size - reserved - 1; }
+    uint8_t* readInner(cursor& at, size_t& size);
     void write(const uint8_t* src, size_t size);
-    void flush(void) { read_p = write_p = buffer; total = 0; }
+    void flush(void);
 };
 
 /****************************************************************************************
- * File buffer
+ * File buffer. It's a sparse file that grows as needed and is read through a memory map
+ * (except on Windows), so that data can be sent in-place. Previous maps are kept when it
+ * grows as readers might still be sending from them
  */
 class fileBuffer : public cacheBuffer {
 private:
+#ifdef _WIN32
     FILE* file;
-    size_t readOffset = 0;
+#else
+    int fd = -1;
+    size_t mapped = 0;
+    std::vector<std::pair<uint8_t*, size_t>> retired;
+    void grow(size_t size);
+#endif
 
 public:
-    fileBuffer(size_t size = 128 * 1024) : cacheBuffer(size) { file = tmpfile(); buffer = new uint8_t[size]; }
-    ~fileBuffer(void) { fclose(file); delete[] buffer; }
-    size_t level(void) { return total; }
-    size_t pending(void) { return total - readOffset; }
-    ssize_t scope(size_t offset) { return offset >= total ? offset - total + 1 : 0; }
-    size_t read(uint8_t* dst, size_t max, size_t min = 0);
-    uint8_t* readInner(size_t& size);
-    void setOffset(size_t offset) { readOffset = offset >= 0 ? offset : 0; }
+    inline static std::string path;
+
+    fileBuffer(size_t size = 128 * 1024);
+    ~fileBuffer(void);
+    uint8_t* readInner(cursor& at, size_t& size);
+#ifdef __linux__
+    int readFile(cursor& at, size_t& offset, size_t& size);
+#endif
+    void write(const uint8_t* src, size_t size);
+    void flush(void) { total = 0; }
+};
+
+#ifndef _WIN32
+/****************************************************************************************
+ * Tiered buffer. Recent data is in a ring buffer (that can be shared with a producer) and
+ * a thread copies everything to a disk file as it arrives, so that nothing is ever lost.
+ * Ring only rolls over what has been spilled and what it does not have anymore is read
+ * from the file, either by the kernel or copied in reader's scratch
+ */
+class tieredBuffer : public cacheBuffer {
+private:
+    ringBuffer ring;
+    int fd = -1;
+    std::thread spiller;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic<size_t> spilled = 0;
+    size_t written = 0;
+    bool running = true, busy = false;
+    std::function<void()> onSpilled;
+
+    void spill(void);
+    size_t oldest(void) { return std::min(ring.total - ring.level(), spilled.load()); }
+
+public:
+    tieredBuffer(size_t size, std::function<void()> onSpilled);
+    ~tieredBuffer(void);
+    std::shared_ptr<byteBuffer> share(size_t capacity) { return ring.share(capacity); }
+    uint8_t* memory(size_t& size) { return ring.memory(size); }
+    size_t window(void) { return ring.capacity(); }
+    size_t pinned(void) { return spilled; }
+    uint8_t* readInner(cursor& at, size_t& size);
+#ifdef __linux__
+    int readFile(cursor& at, size_t& offset, size_t& size);
+#endif
     void write(const uint8_t* src, size_t size);
-    void flush(void) { readOffset = total = 0; }
+    void flush(void);
+};
+#endif
+
+/****************************************************************************************
+ * Track buffer. Read-only view of a complete track held by the track cache, it is never
+ * written to (whoever owns the data must keep it)
+ */
+class trackBuffer : public cacheBuffer {
+public:
+    trackBuffer(const std::vector<uint8_t>& data) : cacheBuffer(data.size()) { buffer = (uint8_t*) data.data(); total = data.size(); }
+    uint8_t* readInner(cursor& at, size_t& size);
+    void write(const uint8_t* src, size_t size) { }
+    void flush(void) { }
+};
+
+/****************************************************************************************
+ * Track cache. Complete encoded tracks are kept process-wide, by track, codec and start, so
+ * that a streamer for one that has already been encoded can serve it as-is. Least recently
+ * used are evicted once capacity is exceeded, but they live as long as someone uses them.
+ * Tracks can also be stored on disk, where they survive restarts. Each one is a file named
+ * after its key that is only visible once complete, so the directory is the index
+ */
+class trackCache {
+public:
+    struct entry {
+        std::vector<uint8_t> data;
+        seekIndex index;
+    };
+
+    inline static size_t capacity = 64 * 1024 * 1024;
+
+    // an empty path means no disk store
+    static void open(const std::string& path, size_t capacity);
+    static bool accepts(size_t size);
+    // id is track and codec, start is where stream begins in track (ms)
+    static std::shared_ptr<entry> get(const std::string& id, int64_t start);
+    static void put(const std::string& id, int64_t start, std::shared_ptr<entry> track);
+    // waits for disk writers, nothing is stored anymore until open() is called again
+    static void close(void);
+
+private:
+    inline static std::mutex mutex;
+    inline static std::list<std::pair<std::string, std::shared_ptr<entry>>> tracks;
+    inline static size_t used = 0;
+    // files on disk, most recently used in front
+    inline static std::string path;
+    inline static size_t diskCapacity = 0, diskUsed = 0;
+    inline static std::list<std::pair<std::string, size_t>> files;
+    inline static std::condition_variable idle;
+    inline static unsigned writers = 0;
+    inline static bool closing = false;
+
+    static void insert(const std::string& key, std::shared_ptr<entry> track);
+    static std::string fileName(const std::string& key);
+    // directory is what path was when file was found or written, path might change since
+    static std::shared_ptr<entry> load(const std::string& key, const std::string& dir, const std::string& name);
+    static void store(const std::string& key, const std::string& dir, std::shared_ptr<entry> track);
+};
+
+/****************************************************************************************
+ * Data waiting to be sent on a non-blocking socket. Items are sent in-place so caller 
+ * must not modify them until queue is empty, except small ones that are copied. Items
+ * can also be a region of a file, sent by the kernel. All consecutive items in memory are
+ * gathered in a single syscall or submitted at once to reactor. In that case, nothing can
+ * be added or removed until it is not busy anymore
+ */
+class sendQueue {
+private:
+    struct {
+        const uint8_t* data;
+        size_t size;
+        int fd;
+        off_t offset;
+    } items[16];
+    size_t count = 0, index = 0;
+    uint8_t pad[255 * 16 + 1 + 64];
+    size_t padUsed = 0;
+#ifndef _WIN32
+    struct iovec iov[sizeof(items) / sizeof(*items)];
+    struct msghdr msg;
+
+    void gather(void);
+#endif
+    void advance(size_t bytes);
+
+public:
+    uint64_t pieces = 0, syscalls = 0;
+    bool busy = false, stale = false;
+
+    bool empty(void) { return index == count; }
+    void clear(void) { count = index = padUsed = 0; }
+    void push(const void* data, size_t size);
+    void copy(const void* data, size_t size);
+    void pushFile(int fd, size_t offset, size_t size);
+    ssize_t send(int sock);
+    bool submit(HTTPreactor* reactor, reactorHandler* handler, int sock);
+    void sent(size_t bytes) { busy = false; advance(bytes); }
+};
+
+/****************************************************************************************
+ * HTTP request received in a fixed buffer and parsed in-place so that nothing is allocated.
+ * End of headers is only searched in what is new. Names are matched regardless of case and
+ * values are trimmed. Views are valid until request is consumed
+ */
+class requestParser {
+private:
+    char data[16 * 1024];
+    size_t used = 0, scanned = 0, end = 0;
+    struct {
+        std::string_view name, value;
+    } fields[32];
+    size_t count = 0;
+
+public:
+    std::string_view method, target, version;
+
+    char* space(size_t& size) { size = sizeof(data) - used; return data + used; }
+    void commit(size_t size) { used += size; }
+    bool append(const char* src, size_t size);
+    bool full(void) { return used == sizeof(data); }
+    bool complete(void);
+    bool parse(void);
+    void consume(void);
+    std::string_view raw(void) { return std::string_view(data, end); }
+    // returns a null view when header is missing
+    std::string_view header(std::string_view name);
+    template <typename F> void forEach(F f) { for (size_t i = 0; i < count; i++) f(fields[i].name, fields[i].value); }
+    static bool equals(std::string_view a, std::string_view b);
+    static bool contains(std::string_view s, std::string_view what);
+};
+
+/****************************************************************************************
+ * HTTP response formatted in a fixed buffer it is sent from
+ */
+struct responseWriter {
+    char data[2048];
+    size_t size = 0;
+
+    void clear(void) { size = 0; }
+    void add(const char* format, ...);
 };
 
 /****************************************************************************************
- * Class to stream audio content with HTTP
+ * Class to stream audio content with HTTP. Several connections can be served at once, each
+ * reading the cache at its own pace while fresh data is added to it by whoever needs it
  */
-class HTTPstreamer : public bell::Task {
+class HTTPstreamer : public reactorHandler {
 private:
-    std::atomic<bool> isRunning = false;
-    std::mutex runningMutex;
+    struct connection {
+        int sock;
+        requestParser rx;
+        responseWriter head;
+        sendQueue tx;
+        cacheBuffer::cursor at;
+        // where cache data queued in tx starts
+        size_t floor = SIZE_MAX;
+        size_t sent = 0;
+        bool sendBody = false, lingering = false, finishing = false;
+        bool firstByte = false, chunked = false, keepAlive = false;
+        std::chrono::steady_clock::time_point requestTime, acceptTime;
+        struct {
+            size_t interval = 0, remain;
+            std::string trackId;
+        } icy;
+    };
+
+    std::atomic<bool> isRunning = false, waiting = false;
+    HTTPreactor* reactor;
+    HTTPlistener* listener;
     std::string host;
     std::string streamUrl;
-    int listenSock = -1;
-    uint16_t port;
+    std::mutex acceptMutex;
+    std::deque<std::pair<int, std::string>> accepted;
+    std::map<int, std::unique_ptr<connection>> connections;
+    unsigned accepts = 0, requests = 0;
     int64_t contentLength = HTTP_CL_NONE;
-    std::unique_ptr<baseCodec> encoder;
+    std::string dlnaFeatures;
+    // where frames are in the cache, filled by encoder
+    std::shared_ptr<seekIndex> index;
+    // what is before first frame, time-seek must send it when starting elsewhere
+    uint8_t streamHeader[16 * 1024];
+    // after a seek in cache, resource is headers then cache from base (at timeBase in stream)
+    size_t base = 0, lead = 0, skip = 0;
+    uint32_t timeBase = 0;
+    bool resumed = false;
+    // track cache id (track and codec) and the track we serve from it, kept as long as we
+    // live because connections might still be sending it
+    std::string codec, cacheKey;
+    std::shared_ptr<trackCache::entry> track;
+    bool attached = false, published = false;
+    // encoder might use cache's memory so it must be deleted first
     std::unique_ptr<cacheBuffer> cache;
-    size_t useCache, scratchLen;
-    uint8_t *scratch;
-    bool flow, chunked;
+    std::unique_ptr<baseCodec> encoder;
+    size_t scratchLen;
+    int bufferIndex = -1;
+    bool flow;
+    // encoder relays Ogg pages as they are fed instead of encoding PCM
+    bool passthrough = false;
+    // set when fresh data can't be cached, whoever releases it must notify us
+    std::atomic<bool> blocked = false;
+    // set when encoder is done and everything it produced is in cache
+    bool exhausted = false;
     int cacheMode;
-    struct {
-        size_t interval, remain;
-        size_t size, count;
-        std::string trackId;
-    } icy;
-
-    void runTask();
-    ssize_t streamBody(int sock, struct timeval& timeout);
-    ssize_t sendChunk(int sock, uint8_t* data, ssize_t size, bool count);
+
+    void onEvent(int sock, int events);
+    void onNotify(void);
+    void onSent(int sock, ssize_t result);
+    void pump(connection& c);
+    void disconnect(connection& c);
+    bool accept(void);
+    bool connect(connection& c);
+    bool fill(void);
+    void makeCache(void);
+    void publish(void);
+    bool streamBody(connection& c);
+    void queueChunk(connection& c, const uint8_t* data, size_t size);
+    void queueFile(connection& c, int fd, size_t offset, size_t size);
     void getMetadata(cspot::TrackInfo& track, metadata_t* metadata);
     onHeadersHandler onHeaders;
     EoSCallback onEoS;
@@ -132,20 +394,60 @@ public:
     std::string streamId;
     cspot::TrackInfo trackInfo;
     std::string trackUnique;
-    int64_t offset;
+    int64_t offset = 0;
     inline static uint16_t portBase = 0, portRange = 1;
     uint64_t totalIn = 0, totalOut = 0;
 
+    // everything that does not depend on the track is done here, so it can be made ahead
     HTTPstreamer(struct in_addr addr, std::string id, unsigned index, std::string codec, 
-                 bool flow, int64_t contentLength, int cacheMode,
-                 cspot::TrackInfo track, std::string_view trackUnique, int32_t startOffset,
-                 onHeadersHandler onHeaders, EoSCallback onEoS);
+                 bool flow, int cacheMode, onHeadersHandler onHeaders, EoSCallback onEoS);
     ~HTTPstreamer();
+    void assign(cspot::TrackInfo track, std::string_view trackUnique, int32_t startOffset, int64_t contentLength);
+    void start(void);
+    void handoff(int sock, std::string request);
+    void drain(void);
     void flush(void);
-    bool connect(int sock);
+    bool seek(uint32_t position);
     bool feedPCMFrames(const uint8_t* data, size_t size);
+    bool feedOggPages(const uint8_t* data, size_t size);
+    bool isPassthrough(void) { return passthrough; }
     std::string getStreamUrl(void) { return streamUrl; }
+    bool matchUrl(std::string_view url);
     void getMetadata(metadata_t* metadata);
     void setContentLength(int64_t contentLength);
+    // the streamer being listened to is encoded first
+    void setPlaying(bool playing) { encoder->playing = playing; }
     std::string trackId() { return trackInfo.trackId; }
 };
+
+/****************************************************************************************
+ * Streamer kept ready for next track, so that a track change does not wait for codec and
+ * cache to be set-up. Spares are only made for players that have started streaming, by
+ * one thread shared by all pools, and only a few of them exist at any time
+ */
+class streamerPool {
+private:
+    std::function<std::shared_ptr<HTTPstreamer>()> make;
+    std::shared_ptr<HTTPstreamer> spare;
+
+    inline static std::mutex mutex;
+    inline static std::condition_variable cv;
+    inline static std::deque<streamerPool*> pending;
+    inline static streamerPool* building = nullptr;
+    inline static unsigned count = 0;
+    inline static bool running = false;
+
+    static void build(void);
+    static void kick(void);
+
+public:
+    // spares alive across all pools, they are memory that idle players don't need
+    inline static unsigned limit = 2;
+
+    streamerPool(std::function<std::shared_ptr<HTTPstreamer>()> make) : make(make) { }
+    ~streamerPool(void) { release(); }
+    // uses spare (or makes one in place) and asks for a new one if there will be a next
+    std::shared_ptr<HTTPstreamer> take(bool next = true);
+    // drops spare and any pending request
+    void release(void);
+};
@@ -0,0 +1,154 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "HTTPuring.h"
+
+#ifdef HAS_IO_URING
+
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/****************************************************************************************
+ * Kernel interface
+ */
+
+static int uringSetup(unsigned entries, struct io_uring_params* params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int uringRegister(int fd, unsigned opcode, void* arg, unsigned count) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+/****************************************************************************************
+ * Ring
+ */
+
+HTTPuring::HTTPuring(unsigned entries) {
+    struct io_uring_params params = { };
+
+    ringFd = uringSetup(entries, &params);
+    if (ringFd < 0) throw std::runtime_error("can't create io_uring " + std::string(strerror(errno)));
+
+    sq.len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq.len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    sq.sqesLen = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // recent kernels map both rings at once
+    if (params.features & IORING_FEAT_SINGLE_MMAP) sq.len = cq.len = std::max(sq.len, cq.len);
+
+    sq.ptr = mmap(NULL, sq.len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) cq.ptr = sq.ptr;
+    else cq.ptr = mmap(NULL, cq.len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    void* sqes = mmap(NULL, sq.sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+
+    if (sq.ptr == MAP_FAILED || cq.ptr == MAP_FAILED || sqes == MAP_FAILED) {
+        int error = errno;
+        if (sqes != MAP_FAILED) munmap(sqes, sq.sqesLen);
+        if (cq.ptr != MAP_FAILED && cq.ptr != sq.ptr) munmap(cq.ptr, cq.len);
+        if (sq.ptr != MAP_FAILED) munmap(sq.ptr, sq.len);
+        close(ringFd);
+        throw std::runtime_error("can't map io_uring " + std::string(strerror(error)));
+    }
+
+    sq.head = (unsigned*) ((char*) sq.ptr + params.sq_off.head);
+    sq.tail = (unsigned*) ((char*) sq.ptr + params.sq_off.tail);
+    sq.mask = (unsigned*) ((char*) sq.ptr + params.sq_off.ring_mask);
+    sq.array = (unsigned*) ((char*) sq.ptr + params.sq_off.array);
+    sq.sqes = (struct io_uring_sqe*) sqes;
+
+    cq.head = (unsigned*) ((char*) cq.ptr + params.cq_off.head);
+    cq.tail = (unsigned*) ((char*) cq.ptr + params.cq_off.tail);
+    cq.mask = (unsigned*) ((char*) cq.ptr + params.cq_off.ring_mask);
+    cq.cqes = (struct io_uring_cqe*) ((char*) cq.ptr + params.cq_off.cqes);
+    sqTail = *sq.tail;
+
+#ifdef IORING_CQE_F_NOTIF
+    // zero-copy send only exists since 6.0
+    size_t len = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    auto probe = (struct io_uring_probe*) calloc(1, len);
+    if (uringRegister(ringFd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0 && probe->last_op >= IORING_OP_SENDMSG_ZC) {
+        zeroCopy = (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED) &&
+                   (probe->ops[IORING_OP_SENDMSG_ZC].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+#endif
+
+#ifdef IORING_RSRC_REGISTER_SPARSE
+    // empty table of buffers, slots are set when streamers come and go
+    struct io_uring_rsrc_register table = { };
+    table.nr = 64;
+    table.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (uringRegister(ringFd, IORING_REGISTER_BUFFERS2, &table, sizeof(table)) == 0) buffers = table.nr;
+#endif
+}
+
+HTTPuring::~HTTPuring(void) {
+    munmap(sq.sqes, sq.sqesLen);
+    if (cq.ptr != sq.ptr) munmap(cq.ptr, cq.len);
+    munmap(sq.ptr, sq.len);
+    close(ringFd);
+}
+
+struct io_uring_sqe* HTTPuring::getSqe(void) {
+    // ring is full, caller must submit first
+    if (sqTail - __atomic_load_n(sq.head, __ATOMIC_ACQUIRE) > *sq.mask) return NULL;
+
+    unsigned index = sqTail++ & *sq.mask;
+    sq.array[index] = index;
+
+    memset(sq.sqes + index, 0, sizeof(struct io_uring_sqe));
+    return sq.sqes + index;
+}
+
+int HTTPuring::submit(unsigned wait) {
+    // what kernel has not taken yet is still between head and tail
+    unsigned count = sqTail - __atomic_load_n(sq.head, __ATOMIC_ACQUIRE);
+    if (!count && !wait) return 0;
+
+    __atomic_store_n(sq.tail, sqTail, __ATOMIC_RELEASE);
+    submits++;
+
+    return uringEnter(ringFd, count, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+}
+
+bool HTTPuring::getCqe(struct io_uring_cqe& cqe) {
+    unsigned head = *cq.head;
+    if (head == __atomic_load_n(cq.tail, __ATOMIC_ACQUIRE)) return false;
+
+    cqe = cq.cqes[head & *cq.mask];
+    __atomic_store_n(cq.head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool HTTPuring::setBuffer(unsigned index, const void* base, size_t size) {
+#ifdef IORING_RSRC_REGISTER_SPARSE
+    struct iovec iov = { (void*) base, size };
+    struct io_uring_rsrc_update2 update = { };
+
+    // NULL base clears the slot
+    update.offset = index;
+    update.data = (uint64_t) &iov;
+    update.nr = 1;
+
+    return uringRegister(ringFd, IORING_REGISTER_BUFFERS_UPDATE, &update, sizeof(update)) >= 0;
+#else
+    return false;
+#endif
+}
+
+#endif
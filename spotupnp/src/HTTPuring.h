@@ -0,0 +1,52 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define HAS_IO_URING
+
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+/****************************************************************************************
+ * Bare io_uring (no liburing needed) that reactor uses to send. Submissions are queued
+ * and only pushed to the kernel by submit(), so that all sends of a reactor loop go in
+ * one syscall. Ring's own fd becomes readable when there are completions
+ */
+class HTTPuring {
+private:
+    int ringFd = -1;
+    struct {
+        unsigned* head, * tail, * mask, * array;
+        struct io_uring_sqe* sqes;
+        void* ptr;
+        size_t len, sqesLen;
+    } sq = { };
+    struct {
+        unsigned* head, * tail, * mask;
+        struct io_uring_cqe* cqes;
+        void* ptr;
+        size_t len;
+    } cq = { };
+    unsigned sqTail = 0;
+
+public:
+    bool zeroCopy = false;
+    unsigned buffers = 0;
+    uint64_t submits = 0;
+
+    HTTPuring(unsigned entries = 256);
+    ~HTTPuring(void);
+    int fd(void) { return ringFd; }
+    struct io_uring_sqe* getSqe(void);
+    int submit(unsigned wait = 0);
+    bool getCqe(struct io_uring_cqe& cqe);
+    bool setBuffer(unsigned index, const void* base, size_t size);
+};
+
+#endif
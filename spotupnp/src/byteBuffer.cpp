@@ -0,0 +1,85 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <cstring>
+#include <algorithm>
+
+#include "byteBuffer.h"
+
+/****************************************************************************************
+ * Ring buffer
+ */
+
+byteBuffer::byteBuffer(FILE* storage, size_t size) {
+    buffer = new uint8_t[size];
+    this->size = this->capacity = size;
+    this->storage = storage;
+}
+
+byteBuffer::byteBuffer(uint8_t* buffer, size_t size, size_t capacity, bool mirrored) :
+                       buffer(buffer), size(size), capacity(std::min(size, capacity)), owned(false), mirrored(mirrored) {
+}
+
+byteBuffer::~byteBuffer(void) { 
+    if (owned) delete[] buffer;
+    if (storage) fclose(storage);
+}
+
+size_t byteBuffer::read(uint8_t* dst, size_t size, size_t min) {
+    size_t tail = this->tail.load(std::memory_order_relaxed);
+    size = std::min(size, head.load(std::memory_order_acquire) - tail);
+    if (size < min) return 0;
+
+    size_t pos = tail % this->size;
+    size_t cont = std::min(size, contiguous(pos));
+    memcpy(dst, buffer + pos, cont);
+    memcpy(dst + cont, buffer, size - cont);
+
+    this->tail.store(tail + size, std::memory_order_release);
+    return size;
+}
+
+uint8_t* byteBuffer::readSpan(size_t &size) {
+    size_t tail = this->tail.load(std::memory_order_relaxed);
+    size_t pos = tail % this->size;
+
+    // 0 means we want everything (contiguous)
+    if (!size) size = this->size;
+
+    size = std::min(size, head.load(std::memory_order_acquire) - tail);
+    size = std::min(size, contiguous(pos));
+
+    return size ? buffer + pos : NULL;
+}
+
+bool byteBuffer::write(const uint8_t* src, size_t size) {
+    size_t head = this->head.load(std::memory_order_relaxed);
+    if (size > capacity - (head - tail.load(std::memory_order_acquire))) return false;
+
+    size_t pos = head % this->size;
+    size_t cont = std::min(size, contiguous(pos));
+    memcpy(buffer + pos, src, cont);
+    memcpy(buffer, src + cont, size - cont);
+
+    if (storage) fwrite(src, size, 1, storage);
+
+    this->head.store(head + size, std::memory_order_release);
+    return true;
+}
+
+uint8_t* byteBuffer::writeSpan(size_t& size) {
+    size_t head = this->head.load(std::memory_order_relaxed);
+    size_t pos = head % this->size;
+
+    size = std::min(capacity - (head - tail.load(std::memory_order_acquire)), contiguous(pos));
+    return size ? buffer + pos : NULL;
+}
+
+void byteBuffer::commitWrite(size_t size) {
+    size_t head = this->head.load(std::memory_order_relaxed);
+    if (storage) fwrite(buffer + head % this->size, size, 1, storage);
+    this->head.store(head + size, std::memory_order_release);
+}
@@ -0,0 +1,52 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+/****************************************************************************************
+ * Ring buffer with one producer and one consumer, no lock. Positions are absolute and 
+ * each side only moves its own. Spans are contiguous so they can be shorter than what
+ * is available (at wrap) and they stay owned by the caller until committed. Memory can
+ * be borrowed from somebody else, then only 'capacity' bytes can be used ahead of the
+ * consumer and if it is mirrored, spans don't stop at wrap. 
+ */
+class byteBuffer {
+private:
+    uint8_t* buffer;
+    size_t size, capacity;
+    bool owned = true, mirrored = false;
+    std::atomic<size_t> head = 0, tail = 0;
+    FILE* storage = NULL;
+
+    size_t contiguous(size_t pos) { return mirrored ? size : size - pos; }
+
+public:
+    byteBuffer(FILE* storage = NULL, size_t size = 4 * 1024 * 1024);
+    byteBuffer(uint8_t* buffer, size_t size, size_t capacity, bool mirrored);
+    ~byteBuffer(void);
+    // only when nobody is using it
+    void reset(void) { head = tail = 0; }
+    // consumer side
+    size_t read(uint8_t* dst, size_t max, size_t min = 0);
+    uint8_t* readSpan(size_t& size);
+    void commitRead(size_t size) { tail.store(tail.load(std::memory_order_relaxed) + size, std::memory_order_release); }
+    void flush(void) { tail.store(head.load(std::memory_order_acquire), std::memory_order_release); }
+    // producer side
+    bool write(const uint8_t* src, size_t size);
+    uint8_t* writeSpan(size_t& size);
+    void commitWrite(size_t size);
+    size_t written(void) { return head.load(std::memory_order_relaxed); }
+    // consumer side
+    size_t consumed(void) { return tail.load(std::memory_order_relaxed); }
+    size_t space(void) { return capacity - used(); }
+    // either side
+    size_t used(void) { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+};
@@ -8,6 +8,10 @@
 #include <cassert>
 #include <cstdint>
 #include <cstring>
+#include <algorithm>
+#include <utility>
+#include <array>
+#include <bit>
 #include "Logger.h"
 #include "spotify.h"
 #include "metadata.h"
@@ -17,6 +21,7 @@
 #endif
 
 #include "codecs.h"
+#include "sampleKernels.h"
 #include "FLAC/stream_encoder.h"
 #include "opusenc.h"
 #include "vorbis/vorbisfile.h"
@@ -27,72 +32,93 @@ extern "C" {
 }
 
 /****************************************************************************************
- * Ring buffer
+ * Seek index
  */
 
-byteBuffer::byteBuffer(FILE* storage, size_t size) {
-    buffer = new uint8_t[size];
-    this->size = size;
-    this->write_p = this->read_p = buffer;
-    this->wrap_p = buffer + size; 
-    this->storage = storage;
-}
-
-byteBuffer::~byteBuffer(void) { 
-    std::scoped_lock lock(mutex); 
-    delete[] buffer;
-    if (storage) fclose(storage);
+void seekIndex::setup(uint32_t rate, size_t frameSize) {
+    std::scoped_lock lock(mutex);
+    this->rate = rate;
+    this->frameSize = frameSize;
+    // a few points per second are close enough for players and it's ~60 bytes per second
+    spacing = rate / 4;
+    points.clear();
+    first = -1;
 }
 
-size_t byteBuffer::read(uint8_t* dst, size_t size, size_t min) {
+void seekIndex::clear(void) {
     std::scoped_lock lock(mutex);
-    size = std::min(size, _used());
-    if (size < min) return 0;
+    points.clear();
+    first = -1;
+}
 
-    size_t cont = std::min(size, (size_t) (wrap_p - read_p));
-    memcpy(dst, read_p, cont);
-    memcpy(dst + cont, buffer, size - cont);
+void seekIndex::assign(seekIndex& from) {
+    std::scoped_lock lock(mutex, from.mutex);
+    rate = from.rate;
+    spacing = from.spacing;
+    frameSize = from.frameSize;
+    points = from.points;
+    first = from.first;
+}
 
-    read_p += size;
-    if (read_p >= wrap_p) read_p -= this->size;
-    return size;
+bool seekIndex::save(FILE* file) {
+    std::scoped_lock lock(mutex);
+    uint64_t header[] = { rate, spacing, frameSize, (uint64_t) first, points.size() };
+    if (fwrite(header, sizeof(header), 1, file) != 1) return false;
+    for (auto& point : points) if (fwrite(&point, sizeof(point), 1, file) != 1) return false;
+    return true;
 }
 
-uint8_t* byteBuffer::readInner(size_t &size) {
-    // unless there is no enough data, we exit with mutex locked
-    mutex.lock();
+bool seekIndex::load(FILE* file) {
+    std::scoped_lock lock(mutex);
+    uint64_t header[5];
+    if (fread(header, sizeof(header), 1, file) != 1 || !header[0] || header[4] > 1024 * 1024) return false;
+
+    rate = header[0];
+    spacing = header[1];
+    frameSize = header[2];
+    first = header[3];
+    points.resize(header[4]);
+    for (auto& point : points) if (fread(&point, sizeof(point), 1, file) != 1) return false;
+    return true;
+}
 
-    // 0 means we want everything (contiguous)
-    if (!size) size = this->size;
+void seekIndex::mark(uint64_t sample, uint64_t offset) {
+    std::scoped_lock lock(mutex);
+    if (first < 0) first = offset;
+    if (points.empty() || sample >= points.back().sample + spacing) points.push_back({ sample, offset });
+}
 
-    // caller *must* consume ALL data
-    size = std::min(size, _used());
-    size = std::min(size, (size_t)(wrap_p - read_p));
+void seekIndex::trim(uint64_t offset) {
+    std::scoped_lock lock(mutex);
+    while (!points.empty() && points.front().offset < offset) points.pop_front();
+}
 
-    if (!size) {
-        mutex.unlock();
-        return NULL;
-    }
+int64_t seekIndex::offsetAt(uint32_t ms) {
+    uint64_t sample = (uint64_t) ms * rate / 1000;
+    std::scoped_lock lock(mutex);
+    if (points.empty() || sample < points.front().sample || sample > points.back().sample) return -1;
 
-    uint8_t* r = read_p; 
-    read_p += size;
-    if (read_p >= wrap_p) read_p -= this->size;
-    
-    return r;
+    auto it = std::upper_bound(points.begin(), points.end(), sample,
+                               [](uint64_t sample, const point& p) { return sample < p.sample; }) - 1;
+    return it->offset + (sample - it->sample) * frameSize;
 }
 
-bool byteBuffer::write(const uint8_t* src, size_t size) {
+int64_t seekIndex::timeAt(uint64_t offset) {
     std::scoped_lock lock(mutex);
-    if (size > _space()) return false;
-
-    size_t cont = std::min(size, (size_t)(wrap_p - write_p));
-    memcpy(write_p, src, cont);
-    memcpy(buffer, src + cont, size - cont);
+    if (points.empty() || offset < points.front().offset) return -1;
 
-    if (storage) fwrite(src, size, 1, storage);
+    auto it = std::upper_bound(points.begin(), points.end(), offset,
+                               [](uint64_t offset, const point& p) { return offset < p.offset; }) - 1;
+    uint64_t sample = it->sample + (frameSize ? (offset - it->offset) / frameSize : 0);
+    return sample * 1000 / rate;
+}
 
-    write_p += size;
-    if (write_p >= wrap_p) write_p -= this->size;
+bool seekIndex::span(uint32_t& first, uint32_t& last) {
+    std::scoped_lock lock(mutex);
+    if (points.empty()) return false;
+    // round up so that first can be looked up
+    first = (points.front().sample * 1000 + rate - 1) / rate;
+    last = points.back().sample * 1000 / rate;
     return true;
 }
 
@@ -128,30 +154,83 @@ baseCodec::baseCodec(codecSettings settings, std::string mimeType, bool store) :
     encoded = pcm;
 }
 
+void baseCodec::setOutput(std::shared_ptr<byteBuffer> buffer) {
+    // pcm codecs don't encode anything, so their input *is* their output
+    if (pcm == encoded) pcm = buffer;
+    encoded = buffer;
+    origin = encoded->written();
+}
+
+void baseCodec::setIndex(std::shared_ptr<seekIndex> index) {
+    // raw pcm can be cut at any frame
+    index->setup(settings.rate, uniform ? settings.channels * settings.size : 0);
+    seek = index;
+}
+
+int64_t baseCodec::initialize(int64_t duration) {
+    // what has been prepared is used once
+    bool prepared = std::exchange(ready, false);
+    if (!prepared && !open()) return 0;
+    return estimate(duration);
+}
+
+void baseCodec::flush(void) {
+    // a worker must not be using buffers
+    encodePool::cancel(this);
+    finishing = finished = false;
+    // stream headers written ahead are gone
+    ready = false;
+    total = 0;
+    pcm->flush();
+    encoded->flush();
+    // what comes next is the beginning of a new stream
+    samples = 0;
+    origin = encoded->written();
+    if (seek) seek->clear();
+}
+
+bool baseCodec::pcmWrite(const uint8_t* data, size_t size) {
+    // when samples are written as-is, every write starts a frame
+    if (pcm == encoded) mark(samples);
+    if (!pcm->write(data, size)) return false;
+    if (pcm == encoded) samples += size / (settings.channels * settings.size);
+    else encodePool::schedule(this);
+    return true;
+}
+
 size_t baseCodec::read(uint8_t* dst, size_t size, size_t min, bool drain) { 
-    // we want to encode more than required but not too much to leave some CPU
-    process(size * 2);
-    size_t bytes = encoded->read(dst, size, min);
+    if (drain) finish();
+    return encoded->read(dst, size, min);
+}
 
-    if (!bytes && drain) {
-        baseCodec::drain();
-        return encoded->read(dst, size, min);
-    } else {
-        return bytes;
-    }
+uint8_t* baseCodec::readSpan(size_t& size, bool drain) { 
+    if (drain) finish();
+    return encoded->readSpan(size);
+}
+
+void baseCodec::commitRead(size_t size) {
+    encoded->commitRead(size);
+    // encoder might be waiting for room
+    if (pcm != encoded && (pcm->used() || (finishing && !finished))) encodePool::schedule(this);
+}
+
+void baseCodec::finish(void) {
+    // nothing more will be fed, encoder can output what it holds once pcm is done
+    if (finishing.exchange(true)) return;
+    if (pcm == encoded) finished = true;
+    else encodePool::schedule(this);
 }
 
-uint8_t* baseCodec::readInner(size_t& size, bool drain) { 
-    // we want to encode more than required but not too much to leave some CPU
-    process(size * 2);
-    uint8_t * data = encoded->readInner(size);
+bool baseCodec::encode(void) {
+    size_t in = pcm->consumed(), out = encoded->written();
+    bool starved = process(64 * 1024);
 
-    if (!data && drain) {
-        baseCodec::drain();
-        return encoded->readInner(size);
-    } else {
-        return data;
+    if (starved && finishing && !finished && drain()) {
+        finished = true;
+        return true;
     }
+
+    return in != pcm->consumed() || out != encoded->written();
 }
 
 std::string baseCodec::id(void) {
@@ -161,41 +240,156 @@ std::string baseCodec::id(void) {
     return std::string();
 }
 
+/****************************************************************************************
+ * Encoding workers
+ */
+
+void encodePool::worker(void) {
+    std::unique_lock lock(mutex);
+
+    while (running) {
+        // helping a codec that is already running goes first
+        if (!batches.empty()) {
+            runTask(batches.front(), lock);
+            continue;
+        }
+
+        auto& queue = queues[0].empty() ? queues[1] : queues[0];
+        if (queue.empty()) {
+            wake.wait(lock);
+            continue;
+        }
+
+        auto codec = queue.front();
+        queue.pop_front();
+        codec->job = baseCodec::RUNNING;
+
+        lock.unlock();
+        bool progress = codec->encode();
+        if (progress && codec->onEncoded) codec->onEncoded();
+        lock.lock();
+
+        // there is probably more to do, or more pcm has arrived while we were encoding
+        if (progress || codec->job == baseCodec::AGAIN) {
+            codec->job = baseCodec::QUEUED;
+            queues[!codec->playing].push_back(codec);
+        } else {
+            codec->job = baseCodec::IDLE;
+        }
+
+        idle.notify_all();
+    }
+
+    workers--;
+    idle.notify_all();
+}
+
+unsigned encodePool::size(void) {
+    return count ? count : std::clamp(std::thread::hardware_concurrency(), 1u, 4u);
+}
+
+void encodePool::schedule(baseCodec* codec) {
+    std::scoped_lock lock(mutex);
+
+    if (!running) {
+        unsigned n = size();
+        // workers must be gone before what they wait on is destroyed, even on a forced exit
+        static bool registered = !std::atexit(stop);
+        running = true;
+        for (; workers < n; workers++) std::thread(worker).detach();
+        CSPOT_LOG(info, "started %u encoding workers (%s sample kernels)", n, sampleKernels::name);
+    }
+
+    // a closed codec might still be fed or read by its owner while it goes away
+    if (codec->job == baseCodec::CLOSED) return;
+
+    if (codec->job == baseCodec::IDLE) {
+        codec->job = baseCodec::QUEUED;
+        queues[!codec->playing].push_back(codec);
+        wake.notify_one();
+    } else if (codec->job == baseCodec::RUNNING) {
+        codec->job = baseCodec::AGAIN;
+    }
+}
+
+void encodePool::cancel(baseCodec* codec, bool close) {
+    std::unique_lock lock(mutex);
+    idle.wait(lock, [codec] { return codec->job != baseCodec::RUNNING && codec->job != baseCodec::AGAIN; });
+    for (auto& queue : queues) queue.erase(std::remove(queue.begin(), queue.end(), codec), queue.end());
+    if (close) codec->job = baseCodec::CLOSED;
+    else if (codec->job != baseCodec::CLOSED) codec->job = baseCodec::IDLE;
+}
+
+void encodePool::runTask(batch* batch, std::unique_lock<std::mutex>& lock) {
+    // whoever takes the last task makes the batch invisible (if it ever was)
+    size_t index = batch->next++;
+    if (batch->next == batch->tasks.size()) {
+        auto it = std::find(batches.begin(), batches.end(), batch);
+        if (it != batches.end()) batches.erase(it);
+    }
+
+    lock.unlock();
+    batch->tasks[index]();
+    lock.lock();
+
+    batch->done++;
+    idle.notify_all();
+}
+
+void encodePool::run(std::vector<std::function<void()>>& tasks) {
+    batch batch = { tasks };
+    std::unique_lock lock(mutex);
+
+    if (tasks.size() > 1 && workers > 1) {
+        batches.push_back(&batch);
+        wake.notify_all();
+    }
+
+    // never wait for a task nobody has taken
+    while (batch.next < tasks.size()) runTask(&batch, lock);
+    idle.wait(lock, [&batch] { return batch.done == batch.tasks.size(); });
+}
+
+void encodePool::stop(void) {
+    std::unique_lock lock(mutex);
+    running = false;
+    wake.notify_all();
+    idle.wait(lock, [] { return !workers; });
+}
+
 /****************************************************************************************
  * PCM codec
  */
 
 class pcmCodec : public::baseCodec {
+private:
+    // bytes at the beginning of encoded that have already been swapped
+    size_t swapped = 0;
+
 public:
     pcmCodec(codecSettings settings, bool store = false);
-    virtual int64_t initialize(int64_t duration) { return duration ? (((int64_t)pcmBitrate * duration) / (8 * 1000)) & ~1LL : -INT64_MAX; }
     virtual size_t read(uint8_t* dst, size_t size, size_t min, bool drain);
-    virtual uint8_t* readInner(size_t& size, bool drain);
+    virtual uint8_t* readSpan(size_t& size, bool drain);
+    virtual void commitRead(size_t size) { swapped -= std::min(size, swapped); baseCodec::commitRead(size); }
+    virtual void flush(void) { swapped = 0; baseCodec::flush(); }
 };
 
 pcmCodec::pcmCodec(codecSettings settings, bool store) :
                    baseCodec(settings, "audio/L16;rate=44100;channels=2", store) {
     icyInterval = 128 * 1024;
+    uniform = true;
     mimeType = "audio/L" + std::to_string(settings.size * 8) + ";rate=" + std::to_string(settings.rate) +
                ";channels=" + std::to_string(settings.channels);
 }
 
-uint8_t* pcmCodec::readInner(size_t& size, bool drain) {
-    uint8_t* data = pcm->readInner(size);
-
-    // will only locked if not empty
-    if (!size) return NULL;
+uint8_t* pcmCodec::readSpan(size_t& size, bool drain) {
+    uint8_t* data = pcm->readSpan(size);
+    if (!data) return NULL;
 
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-    // pcm needs byte swapping on little endian CPU
-    uint16_t* swap = (uint16_t*)data;
-    for (size_t i = size / settings.size; i; i--) {
-#ifdef _WIN32
-        * swap++ = _byteswap_ushort(*swap);
-#else
-        * swap++ = __builtin_bswap16(*swap);
-#endif
-    }
+    // pcm needs byte swapping on little endian CPU, but only do it once (we own the span)
+    if (size > swapped) sampleKernels::byteswap((uint16_t*) (data + swapped), (size - swapped) / settings.size);
+    swapped = std::max(swapped, size);
 #endif
     return data;
 }
@@ -203,15 +397,10 @@ uint8_t* pcmCodec::readInner(size_t& size, bool drain) {
 size_t pcmCodec::read(uint8_t* dst, size_t size, size_t min, bool drain) {
     size_t bytes = encoded->read(dst, size, min);
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-    // pcm needs byte swapping on little endian CPU
-    uint16_t* swap = (uint16_t*) dst;
-    for (int i = bytes / settings.size; i; i--) {
-#ifdef _WIN32
-        * swap++ = _byteswap_ushort(*swap);
-#else
-        * swap++ = __builtin_bswap16(*swap);
-#endif
-    }
+    // pcm needs byte swapping on little endian CPU (unless already done by a span)
+    size_t done = std::min(bytes, swapped);
+    swapped -= done;
+    sampleKernels::byteswap((uint16_t*) (dst + done), (bytes - done) / settings.size);
 #endif
     return bytes;
 }
@@ -225,7 +414,7 @@ private:
     size_t position = 0;
 
 public:
-    wavCodec(codecSettings settings, bool store = false) : baseCodec(settings, "audio/wav", store) { icyInterval = 128 * 1024; }
+    wavCodec(codecSettings settings, bool store = false) : baseCodec(settings, "audio/wav", store) { icyInterval = 128 * 1024; uniform = true; }
     virtual int64_t initialize(int64_t duration);
 };
 
@@ -280,34 +469,103 @@ int64_t wavCodec::initialize(int64_t duration) {
 }
 
 /****************************************************************************************
- * FLAC codec
+ * FLAC codec. Frames are independent, so when there are several workers, what pcm holds 
+ * is cut in segments of whole frames that are encoded at once by their own encoder. Each
+ * encoder numbers frames from 0, so frame headers (and CRC) are rewritten with the right
+ * number when frames are put back in order. Stream header comes from the main encoder.
+ * Segment encoders are only made when there is something to encode, as many as needed
  */
 
 class flacCodec : public::baseCodec {
 private:
+    struct segment {
+        FLAC__StreamEncoder* flac = NULL;
+        const int16_t* pcm;
+        size_t count;
+        std::vector<FLAC__int32> scratch;
+        // encoded frames, where they start and their samples
+        std::vector<uint8_t> data;
+        std::vector<std::pair<size_t, unsigned>> frames;
+    };
+
     FLAC__StreamEncoder* flac = NULL;
-    bool drained = false;
+    bool drained = false, parallel = false;
+    FLAC__int32 scratch[4096 * 2];
+    std::vector<segment> segments;
+    std::vector<int16_t> input;
+    unsigned blockSize = 0, segmentSize = 0;
+    uint64_t frameNumber = 0;
+
+    bool process(size_t bytes);
+    bool drain(void);
+    bool open(void);
+    int64_t estimate(int64_t duration);
+    bool processSegments(size_t bytes);
+    void makeSegments(size_t count);
+    void encodeSegments(size_t count);
+    void encodeSegment(segment& segment);
+    void writeFrame(const uint8_t* frame, size_t size, unsigned count);
 
 public:
-    flacCodec(codecSettings settings, bool store = false) : baseCodec(settings, "audio/flac", store) { icyInterval = 128 * 1024; }
+    flacCodec(codecSettings settings, bool store = false);
     virtual ~flacCodec(void);
-    virtual int64_t initialize(int64_t duration);
-    virtual bool pcmWrite(const uint8_t* data, size_t size);
-    virtual void drain(void);
 };
 
+static uint8_t flacCRC8(const uint8_t* data, size_t size) {
+    static const auto table = [] {
+        std::array<uint8_t, 256> table;
+        for (unsigned i = 0; i < 256; i++) {
+            uint8_t crc = i;
+            for (int bit = 0; bit < 8; bit++) crc = (crc << 1) ^ (crc & 0x80 ? 0x07 : 0);
+            table[i] = crc;
+        }
+        return table;
+    }();
+
+    uint8_t crc = 0;
+    while (size--) crc = table[crc ^ *data++];
+    return crc;
+}
+
+static uint16_t flacCRC16(uint16_t crc, const uint8_t* data, size_t size) {
+    static const auto table = [] {
+        std::array<uint16_t, 256> table;
+        for (unsigned i = 0; i < 256; i++) {
+            uint16_t crc = i << 8;
+            for (int bit = 0; bit < 8; bit++) crc = (crc << 1) ^ (crc & 0x8000 ? 0x8005 : 0);
+            table[i] = crc;
+        }
+        return table;
+    }();
+
+    while (size--) crc = (crc << 8) ^ table[(crc >> 8) ^ *data++];
+    return crc;
+}
+
+flacCodec::flacCodec(codecSettings settings, bool store) : baseCodec(settings, "audio/flac", store) {
+    icyInterval = 128 * 1024;
+    pcm.reset();
+    pcm = std::make_shared<byteBuffer>();
+}
+
 flacCodec::~flacCodec(void) {
     if (flac) FLAC__stream_encoder_delete((FLAC__StreamEncoder*)flac);
+    for (auto& segment : segments) FLAC__stream_encoder_delete(segment.flac);
 }
 
-int64_t flacCodec::initialize(int64_t duration) {
+bool flacCodec::open(void) {
     // clean any current decoder 
     if (flac) FLAC__stream_encoder_delete((FLAC__StreamEncoder*)flac);
     drained = false;
+    frameNumber = 0;
 
     auto flacWrite = [](const FLAC__StreamEncoder* encoder, const FLAC__byte buffer[],
         size_t bytes, unsigned samples, unsigned current_frame, void* client_data) {
-            if (((flacCodec*)client_data)->encoded->write(buffer, bytes)) return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+            auto codec = (flacCodec*) client_data;
+            // each frame is written at once, metadata have no samples
+            if (samples) codec->mark(codec->samples);
+            codec->samples += samples;
+            if (codec->encoded->write(buffer, bytes)) return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
             else return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
     };
 
@@ -324,26 +582,191 @@ int64_t flacCodec::initialize(int64_t duration) {
 
     if (!ok) throw std::runtime_error("Cannot set FLAC parameters");
 
+    // segments must use the blocksize that stream header announces, they are long enough
+    // for encoder set-up to be nothing and short enough to be spread 
+    blockSize = FLAC__stream_encoder_get_blocksize(flac);
+    segmentSize = std::max(16384 / blockSize, 1u) * blockSize;
+    parallel = encodePool::size() > 1;
+
+    return true;
+}
+
+void flacCodec::makeSegments(size_t count) {
+    // encoders are kept once made, blocksize and level never change
+    for (FLAC__bool ok = true; segments.size() < count; ) {
+        auto& segment = segments.emplace_back();
+        segment.flac = FLAC__stream_encoder_new();
+        if (!segment.flac) throw std::runtime_error("Cannot create FLAC encoder");
+        ok &= FLAC__stream_encoder_set_verify(segment.flac, false);
+        ok &= FLAC__stream_encoder_set_compression_level(segment.flac, settings.flac.level);
+        ok &= FLAC__stream_encoder_set_channels(segment.flac, settings.channels);
+        ok &= FLAC__stream_encoder_set_bits_per_sample(segment.flac, settings.size * 8);
+        ok &= FLAC__stream_encoder_set_sample_rate(segment.flac, settings.rate);
+        ok &= FLAC__stream_encoder_set_blocksize(segment.flac, blockSize);
+        ok &= FLAC__stream_encoder_set_streamable_subset(segment.flac, true);
+        ok &= FLAC__stream_encoder_set_do_md5(segment.flac, false);
+        segment.scratch.resize(blockSize * settings.channels);
+        if (!ok) throw std::runtime_error("Cannot set FLAC parameters");
+    }
+}
+
+int64_t flacCodec::estimate(int64_t duration) {
     double ratio[] = { 0.8, 0.79, 0.78, 0.75, 0.72, 0.71, 0.70, 0.68, 0.65 };
     return -(duration ? (pcmBitrate * duration * ratio[settings.flac.level]) / (8 * 1000) : INT64_MAX);
 }
 
-bool flacCodec::pcmWrite(const uint8_t* data, size_t len) {
-    if (encoded->space() < std::max(len * 2, minSpace)) return false;
-    //assert((size & 0x03) != 0);
+bool flacCodec::process(size_t bytes) {
+    if (parallel) return processSegments(bytes);
 
-    auto flacSamples = new FLAC__int32[len];
-    for (size_t i = 0; i < len / settings.size; i++, data += settings.size) flacSamples[i] = *(int16_t*)data;
-    FLAC__stream_encoder_process_interleaved((FLAC__StreamEncoder*)flac, flacSamples, len / (settings.size * settings.channels));
-    delete[] flacSamples;
+    size_t out = encoded->written();
 
-    return true;
+    while (encoded->space() >= 2 * minSpace && encoded->written() - out < bytes) {
+        size_t len = sizeof(scratch) / sizeof(FLAC__int32) * settings.size;
+        int16_t* data = (int16_t*) pcm->readSpan(len);
+        if (!data) return true;
+
+        sampleKernels::widen(data, scratch, len / settings.size);
+        FLAC__stream_encoder_process_interleaved((FLAC__StreamEncoder*)flac, scratch, len / (settings.size * settings.channels));
+        pcm->commitRead(len);
+    }
+
+    return !pcm->used();
+}
+
+bool flacCodec::processSegments(size_t bytes) {
+    size_t frameSize = blockSize * settings.channels * settings.size;
+    // encoded frames can be (a bit) larger than pcm and they must all fit
+    size_t worstSize = frameSize + frameSize / 16 + 64;
+    size_t out = encoded->written();
+
+    while (encoded->written() - out < bytes) {
+        size_t count = std::min(pcm->used() / frameSize, encodePool::size() * segmentSize / blockSize);
+        count = std::min(count, (encoded->space() - std::min(encoded->space(), minSpace)) / worstSize);
+        if (!count) break;
+        encodeSegments(count * blockSize);
+    }
+
+    // what is less than a frame waits for more, or for drain
+    return pcm->used() < frameSize;
+}
+
+void flacCodec::encodeSegments(size_t count) {
+    size_t bytes = count * settings.channels * settings.size;
+    size_t len = bytes;
+    
+    // use pcm in-place unless it wraps
+    const int16_t* data = (int16_t*) pcm->readSpan(len);
+    bool copied = len < bytes;
+    if (copied) {
+        input.resize(bytes / settings.size);
+        pcm->read((uint8_t*) input.data(), bytes);
+        data = input.data();
+    }
+
+    makeSegments((count + segmentSize - 1) / segmentSize);
+
+    std::vector<std::function<void()>> tasks;
+    for (size_t i = 0, at = 0; at < count; i++, at += segmentSize) {
+        auto& segment = segments[i];
+        segment.pcm = data + at * settings.channels;
+        segment.count = std::min((size_t) segmentSize, count - at);
+        tasks.push_back([this, &segment] { encodeSegment(segment); });
+    }
+
+    if (tasks.size() > 1) encodePool::run(tasks);
+    else tasks.front()();
+
+    if (!copied) pcm->commitRead(bytes);
+
+    // put frames back in order with their number in stream
+    for (size_t i = 0; i < tasks.size(); i++) {
+        auto& segment = segments[i];
+        for (size_t j = 0; j < segment.frames.size(); j++) {
+            auto [at, samples] = segment.frames[j];
+            size_t end = j + 1 < segment.frames.size() ? segment.frames[j + 1].first : segment.data.size();
+            writeFrame(segment.data.data() + at, end - at, samples);
+        }
+    }
+}
+
+void flacCodec::encodeSegment(segment& segment) {
+    auto segmentWrite = [](const FLAC__StreamEncoder* encoder, const FLAC__byte buffer[],
+        size_t bytes, unsigned samples, unsigned current_frame, void* client_data) {
+            auto segment = (flacCodec::segment*) client_data;
+            // stream header is from main encoder
+            if (!samples) return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+            segment->frames.emplace_back(segment->data.size(), samples);
+            segment->data.insert(segment->data.end(), buffer, buffer + bytes);
+            return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+    };
+
+    segment.data.clear();
+    segment.frames.clear();
+    FLAC__stream_encoder_init_stream(segment.flac, segmentWrite, NULL, NULL, NULL, &segment);
+
+    for (size_t done = 0; done < segment.count; ) {
+        size_t count = std::min((size_t) blockSize, segment.count - done);
+        sampleKernels::widen(segment.pcm + done * settings.channels, segment.scratch.data(), count * settings.channels);
+        FLAC__stream_encoder_process_interleaved(segment.flac, segment.scratch.data(), count);
+        done += count;
+    }
+
+    // last frame is only encoded now (and encoder is ready to be set-up again)
+    FLAC__stream_encoder_finish(segment.flac);
+}
+
+void flacCodec::writeFrame(const uint8_t* frame, size_t size, unsigned count) {
+    uint8_t header[16];
+
+    // sync and 2 bytes, then utf-8 coded frame number (sample number when blocksize varies)
+    memcpy(header, frame, 4);
+    size_t skip = frame[4] < 0x80 ? 1 : std::countl_one(frame[4]);
+    uint64_t number = frame[1] & 0x01 ? samples : frameNumber;
+    size_t len = 4;
+
+    if (number < 0x80) {
+        header[len++] = number;
+    } else {
+        // a lead byte with as many bits set as there are bytes, then 6 bits per byte
+        int extra = 1;
+        while (extra < 6 && number >= 1ULL << (5 * extra + 6)) extra++;
+        header[len++] = (uint8_t) (0xff00 >> (extra + 1)) | (number >> (6 * extra));
+        for (int i = extra - 1; i >= 0; i--) header[len++] = 0x80 | ((number >> (6 * i)) & 0x3f);
+    }
+
+    // optional blocksize and sample rate follow as-is, then CRC-8 of all that
+    size_t from = 4 + skip;
+    size_t extra = ((frame[2] >> 4) == 6) + ((frame[2] >> 4) == 7) * 2 + ((frame[2] & 0x0f) == 12) + ((frame[2] & 0x0f) >= 13) * 2;
+    memcpy(header + len, frame + from, extra);
+    len += extra;
+    header[len] = flacCRC8(header, len);
+    len++;
+    from += extra + 1;
+
+    // body is unchanged but CRC-16 covers the whole frame
+    size_t body = size - from - 2;
+    uint16_t crc = flacCRC16(flacCRC16(0, header, len), frame + from, body);
+    uint8_t footer[2] = { (uint8_t) (crc >> 8), (uint8_t) crc };
+
+    mark(samples);
+    encoded->write(header, len);
+    encoded->write(frame + from, body);
+    encoded->write(footer, 2);
+    frameNumber++;
+    samples += count;
 }
 
-void flacCodec::drain(void) {
-    if (drained) return;
-    FLAC__stream_encoder_finish((FLAC__StreamEncoder*)flac);
-    drained = true;
+bool flacCodec::drain(void) {
+    if (drained || encoded->space() < 2 * minSpace) return drained;
+
+    // what is left is less than a frame, it is the last one
+    if (parallel) {
+        if (size_t count = pcm->used() / (settings.channels * settings.size); count) encodeSegments(count);
+    } else {
+        FLAC__stream_encoder_finish((FLAC__StreamEncoder*)flac);
+    }
+
+    return drained = true;
 }
 
 /****************************************************************************************
@@ -357,14 +780,15 @@ private:
     bool drained = false;
     uint8_t* inBuf = NULL, * outBuf = NULL;
 
-    void process(size_t bytes);
+    bool process(size_t bytes);
+    bool drain(void);
     void cleanup(void);
+    bool open(void);
+    int64_t estimate(int64_t duration) { return -(duration ? ((int64_t)settings.aac.bitrate * duration) / 8 : INT64_MAX); }
 
 public:
     aacCodec(codecSettings settings, bool store = false);
     virtual ~aacCodec(void) { cleanup(); }
-    virtual int64_t initialize(int64_t duration);
-    virtual void drain(void);
 };
 
 aacCodec::aacCodec(codecSettings settings, bool store) : baseCodec(settings, "audio/aac", false) {
@@ -380,14 +804,13 @@ void aacCodec::cleanup(void) {
     }
 }
 
-int64_t aacCodec::initialize(int64_t duration) {
+bool aacCodec::open(void) {
     // clean any current decoder 
     cleanup();
     drained = false;
 
-    // in case of failure, return 0
     aac = faacEncOpen(settings.rate, settings.channels, &inSamples, &outMaxBytes);    
-    if (!aac) return 0;
+    if (!aac) return false;
 
     // inSamples is the *total* number of samples, not of frames...
     inBuf = new uint8_t[inSamples * settings.size];
@@ -400,25 +823,51 @@ int64_t aacCodec::initialize(int64_t duration) {
     format->outputFormat = ADTS_STREAM;
     format->inputFormat = FAAC_INPUT_16BIT;
     faacEncSetConfiguration(aac, format);
-    
-    return -(duration ? ((int64_t)settings.aac.bitrate * duration) / 8 : INT64_MAX);
+    return true;
 }
 
-void aacCodec::process(size_t bytes) {
+bool aacCodec::process(size_t bytes) {
     size_t blockSize = inSamples * settings.size;
     while (encoded->space() >= outMaxBytes && pcm->used() >= blockSize && (ssize_t)bytes > 0) {
-        pcm->read(inBuf, blockSize);
-        int len = faacEncEncode(aac, (int32_t*) inBuf, inSamples, outBuf, outMaxBytes);
-        encoded->write(outBuf, len);
+        // use pcm and encoded in-place unless they wrap
+        size_t inLen = blockSize, outLen = outMaxBytes;
+        uint8_t* in = pcm->readSpan(inLen);
+        uint8_t* out = encoded->writeSpan(outLen);
+
+        if (inLen < blockSize) {
+            pcm->read(inBuf, blockSize);
+            in = inBuf;
+        }
+        if (outLen < outMaxBytes) out = outBuf;
+
+        int len = faacEncEncode(aac, (int32_t*) in, inSamples, out, outMaxBytes);
+        if (in != inBuf) pcm->commitRead(blockSize);
+
+        // an error must not move encoded's head (it would wrap), that block is lost
+        if (len < 0) {
+            CSPOT_LOG(error, "AAC encoding error %d", len);
+            continue;
+        }
+
+        // encoder has some delay but every ADTS frame it outputs is one block
+        if (len > 0) {
+            mark(samples);
+            samples += inSamples / settings.channels;
+        }
+
+        if (out == outBuf) encoded->write(outBuf, len);
+        else encoded->commitWrite(len);
         bytes -= len;
     }
+
+    return pcm->used() < blockSize;
 }
 
-void aacCodec::drain(void) {
-    if (drained || encoded->space() < outMaxBytes) return;
+bool aacCodec::drain(void) {
+    if (drained || encoded->space() < outMaxBytes) return drained;
     int len = faacEncEncode(aac, NULL, 0, outBuf, outMaxBytes);
-    encoded->write(outBuf, len);
-    drained = true;
+    if (len > 0) encoded->write(outBuf, len);
+    return drained = true;
 }
 
 /****************************************************************************************
@@ -432,14 +881,15 @@ private:
     size_t blockSize;
     int16_t* scratch;
 
-    void process(size_t bytes);
+    bool process(size_t bytes);
+    bool drain(void);
     void cleanup();
+    bool open(void);
+    int64_t estimate(int64_t duration) { return -(duration ? ((int64_t)settings.mp3.bitrate * duration) / 8 : INT64_MAX); }
 
 public:
     mp3Codec(codecSettings settings, bool store = false);
     virtual ~mp3Codec(void) { cleanup(); }
-    virtual int64_t initialize(int64_t duration);
-    virtual void drain(void);
     virtual std::string id() { return std::string("mp3"); }
 };
 
@@ -455,7 +905,7 @@ void mp3Codec::cleanup(void) {
     }
 }
 
-int64_t mp3Codec::initialize(int64_t duration) {
+bool mp3Codec::open(void) {
     struct PACK({
         uint8_t	 id[3];
         uint8_t  version[2];
@@ -499,27 +949,40 @@ int64_t mp3Codec::initialize(int64_t duration) {
     blockSize = shine_samples_per_pass(mp3) * settings.channels;
     scratch = new int16_t[blockSize];
     blockSize *= settings.size;
-
-    return -(duration ? ((int64_t)settings.mp3.bitrate * duration) / 8 : INT64_MAX);
+    return true;
 }
 
-void mp3Codec::process(size_t bytes) {
+bool mp3Codec::process(size_t bytes) {
     auto space = std::max(blockSize, minSpace);
     int len;
     while (encoded->space() >= space && pcm->used() >= blockSize && (ssize_t) bytes > 0) {
-        pcm->read((uint8_t*)scratch, blockSize);
-        uint8_t* coded = shine_encode_buffer_interleaved(mp3, scratch, &len);
+        // use pcm in-place unless it wraps
+        size_t inLen = blockSize;
+        int16_t* in = (int16_t*) pcm->readSpan(inLen);
+        if (inLen < blockSize) {
+            pcm->read((uint8_t*) scratch, blockSize);
+            in = scratch;
+        }
+
+        uint8_t* coded = shine_encode_buffer_interleaved(mp3, in, &len);
+        if (in != scratch) pcm->commitRead(blockSize);
+
+        // there is no bit reservoir, each pass is a set of frames that stand on their own
+        if (len > 0) mark(samples);
+        samples += blockSize / (settings.channels * settings.size);
         encoded->write(coded, len);
         bytes -= len;
     }
+
+    return pcm->used() < blockSize;
 }
 
-void mp3Codec::drain(void) {
-    if (drained || encoded->space() < std::max(blockSize, minSpace)) return;
+bool mp3Codec::drain(void) {
+    if (drained || encoded->space() < std::max(blockSize, minSpace)) return drained;
     int len;
     uint8_t* coded = shine_flush(mp3, &len);
     encoded->write(coded, len);
-    drained = true;
+    return drained = true;
 }
 
 /****************************************************************************************
@@ -530,28 +993,41 @@ class opusCodec : public::baseCodec {
 private:
     OggOpusEnc* opus = NULL;
     bool drained = false;
+    uint16_t preSkip = 0;
+    int bitrate = 0;
+
+    void indexPage(const uint8_t* page, size_t len);
+    bool process(size_t bytes);
+    bool drain(void);
+    bool open(void);
+    int64_t estimate(int64_t duration) { return -(duration ? ((int64_t)bitrate * duration) / 8 : INT64_MAX); }
     
 public:
-    opusCodec(codecSettings settings, bool store = false) : baseCodec(settings, "audio/ogg;codecs=opus", store) { }
+    opusCodec(codecSettings settings, bool store = false);
     virtual ~opusCodec(void);
-    virtual int64_t initialize(int64_t duration);
-    virtual bool pcmWrite(const uint8_t* data, size_t size);
-    virtual void drain(void);
     virtual std::string id() { return std::string("ops"); }
 };
 
+opusCodec::opusCodec(codecSettings settings, bool store) : baseCodec(settings, "audio/ogg;codecs=opus", store) {
+    pcm.reset();
+    pcm = std::make_shared<byteBuffer>();
+}
+
 opusCodec::~opusCodec(void) {
     if (opus) ope_encoder_destroy(opus);
 }
 
-int64_t opusCodec::initialize(int64_t duration) {  
+bool opusCodec::open(void) {  
     // clean any current decoder 
     if (opus) ope_encoder_destroy(opus);
     drained = false;
 
     OpusEncCallbacks callbacks = {
         .write = [](void* user_data, const unsigned char* ptr, opus_int32 len) {
-                    return ((opusCodec*)user_data)->encoded->write(ptr, len) ? 0 : 1;
+                    // we always receive a whole page
+                    auto codec = (opusCodec*)user_data;
+                    codec->indexPage(ptr, len);
+                    return codec->encoded->write(ptr, len) ? 0 : 1;
         }, 
         .close = [](void* user_data) {
                     return 0;
@@ -562,26 +1038,51 @@ int64_t opusCodec::initialize(int64_t duration) {
     opus = ope_encoder_create_callbacks(&callbacks, this, comments, settings.rate, settings.channels, 1, NULL);
     ope_comments_destroy(comments);
 
-    // in case of failure, return 0
-    if (!opus) return 0;
+    if (!opus) return false;
 
-    int bitrate = settings.opus.bitrate * 1000;
+    bitrate = settings.opus.bitrate * 1000;
     if (bitrate) ope_encoder_ctl(opus, OPUS_SET_BITRATE(bitrate));
     else ope_encoder_ctl(opus, OPUS_GET_BITRATE(&bitrate));
-   
-    return -(duration ? ((int64_t)bitrate * duration) / 8 : INT64_MAX);
+    return true;
+}
+
+void opusCodec::indexPage(const uint8_t* page, size_t len) {
+    if (len < 27 || len < 27u + page[26]) return;
+
+    int64_t granule = 0;
+    for (int i = 7; i >= 0; i--) granule = (granule << 8) | page[6 + i];
+
+    // pre-skip is in the identification header, granule are at 48kHz and include it
+    const uint8_t* body = page + 27 + page[26];
+    if (len >= (size_t) (body - page) + 12 && !memcmp(body, "OpusHead", 8)) preSkip = body[10] | (body[11] << 8);
+
+    // headers have a 0 granule and a page starts where previous one ended, unless it continues a packet
+    if (granule && !(page[5] & 0x01)) mark(samples);
+    if (granule > preSkip) samples = (granule - preSkip) * settings.rate / 48000;
 }
 
-bool opusCodec::pcmWrite(const uint8_t * data, size_t len) {
+bool opusCodec::process(size_t bytes) {
+    size_t out = encoded->written();
+
     // we do not block (at least it should not happen)
-    if (encoded->space() < std::max(len * 2, minSpace)) return false;
-    return ope_encoder_write(opus, (opus_int16*)data, len / (settings.channels * settings.size)) == 0;
+    while (encoded->space() >= 2 * minSpace && encoded->written() - out < bytes) {
+        size_t len = minSpace;
+        uint8_t* data = pcm->readSpan(len);
+        if (!data) return true;
+
+        if (ope_encoder_write(opus, (opus_int16*) data, len / (settings.channels * settings.size))) {
+            CSPOT_LOG(error, "opus encoding error");
+        }
+        pcm->commitRead(len);
+    }
+
+    return !pcm->used();
 }
 
-void opusCodec::drain(void) {
-    if (drained || encoded->space() < minSpace) return;
+bool opusCodec::drain(void) {
+    if (drained || encoded->space() < minSpace) return drained;
     ope_encoder_drain(opus);
-    drained = true;
+    return drained = true;
 }
 
 /****************************************************************************************
@@ -599,14 +1100,15 @@ private:
 
     bool drained = false;
 
-    void process(size_t bytes);
+    bool process(size_t bytes);
+    bool drain(void);
     void cleanup(void);
+    bool open(void);
+    int64_t estimate(int64_t duration) { return -(duration ? ((int64_t)settings.vorbis.bitrate * duration) / 8 : INT64_MAX); }
 
 public:
     vorbisCodec(codecSettings settings, bool store = false);
     virtual ~vorbisCodec(void) { cleanup(); }
-    virtual int64_t initialize(int64_t duration);
-    virtual void drain(void);
     virtual std::string id() { return std::string("oga"); }
 };
 
@@ -624,7 +1126,7 @@ void vorbisCodec::cleanup(void) {
     }
 }
 
-int64_t vorbisCodec::initialize(int64_t duration) {
+bool vorbisCodec::open(void) {
     // clean any current decoder 
     cleanup();
     drained = false;
@@ -636,7 +1138,7 @@ int64_t vorbisCodec::initialize(int64_t duration) {
     //  assume that only this part can go wrong
     if (vorbis_encode_init(&info, settings.channels, settings.rate, bitrate, bitrate * 1.25, bitrate * 0.75)) {
         vorbis_info_clear(&info);
-        return 0;
+        return false;
     }
 
     initialized = true;
@@ -661,24 +1163,20 @@ int64_t vorbisCodec::initialize(int64_t duration) {
 
     // finally initialize a block structure (once is enough)
     vorbis_block_init(&dsp, &block);
-
-    return -(duration ? ((int64_t)settings.vorbis.bitrate * duration) / 8 : INT64_MAX);
+    return true;
 }
 
-void vorbisCodec::process(size_t bytes) {
+bool vorbisCodec::process(size_t bytes) {
     while (encoded->space() >= minSpace && pcm->used() > 1024 * settings.channels * settings.size && (ssize_t)bytes > 0) {
         size_t len = 1024 * settings.channels * settings.size;
         // we are always aligned on settings.channels * settings.size;
-        int16_t *data = (int16_t*) pcm->readInner(len);
-        len /= settings.channels * settings.size;
+        int16_t *data = (int16_t*) pcm->readSpan(len);
+        size_t frames = len / (settings.channels * settings.size);
 
-        float** buffer = vorbis_analysis_buffer(&dsp, len);
-        for (size_t i = 0; i < len; i++) {
-            buffer[0][i] = *data++ / (float) INT16_MAX;
-            buffer[1][i] = *data++ / (float) INT16_MAX;
-        }
-        pcm->unlock();
-        vorbis_analysis_wrote(&dsp, len);
+        float** buffer = vorbis_analysis_buffer(&dsp, frames);
+        sampleKernels::deinterleave(data, buffer[0], buffer[1], frames);
+        pcm->commitRead(len);
+        vorbis_analysis_wrote(&dsp, frames);
 
         // encode as many blocks as possible
         while (vorbis_analysis_blockout(&dsp, &block)) {
@@ -694,6 +1192,9 @@ void vorbisCodec::process(size_t bytes) {
 
                 // get as many pages as possible (we assume we won't write more than space here...)
                 while (ogg_stream_pageout(&stream, &page)) {
+                    // a page starts where previous one ended, unless it continues a packet
+                    if (!ogg_page_continued(&page)) mark(samples);
+                    if (ogg_page_granulepos(&page) > 0) samples = ogg_page_granulepos(&page);
                     encoded->write(page.header, page.header_len);
                     encoded->write(page.body, page.body_len);
                     // don't need to be exact on written bytes
@@ -702,10 +1203,12 @@ void vorbisCodec::process(size_t bytes) {
             }
         }
     }
+
+    return pcm->used() <= 1024 * settings.channels * settings.size;
 }
 
-void vorbisCodec::drain(void) {
-    if (drained || encoded->space() < minSpace) return;
+bool vorbisCodec::drain(void) {
+    if (drained || encoded->space() < minSpace) return drained;
 
     ogg_page page;
 
@@ -714,7 +1217,232 @@ void vorbisCodec::drain(void) {
         encoded->write(page.body, page.body_len);
     }
 
-    drained = true;
+    return drained = true;
+}
+
+/****************************************************************************************
+ * OGG passthrough. Spotify's Ogg Vorbis is relayed without being decoded, what is fed is Ogg
+ * pages (from whatever point in the track) and what is sent is a clean logical stream: our
+ * own serial, pages numbered from 0, granule positions rebased so that time starts at 0 and
+ * checksums redone. After a flush (seek), source does not send headers again so the ones we
+ * have are replayed. A new source stream (track change in flow) starts a new chained stream.
+ * The last page is held back so that it can be flagged as end of stream
+ */
+
+class oggCodec : public::baseCodec {
+private:
+    ogg_sync_state sync;
+    // source stream, only parsed to get headers and packets sizes
+    ogg_stream_state in;
+    vorbis_info info;
+    vorbis_comment comment;
+    bool initialized = false, drained = false;
+    int headerPackets = 0;
+    long lastBlock = 0;
+    // source headers pages, to start again after a flush
+    std::vector<std::vector<uint8_t>> headers;
+    // output stream
+    uint32_t serial = 0, sequence = 0;
+    bool started = false;
+    int64_t base = -1;
+    uint64_t chainStart = 0;
+    std::vector<uint8_t> held;
+
+    bool process(size_t bytes);
+    bool drain(void);
+    void cleanup(void);
+    bool open(void);
+    int64_t estimate(int64_t duration) { return -(duration ? ((int64_t)settings.vorbis.bitrate * duration) / 8 : INT64_MAX); }
+    void sourceStart(ogg_page& page);
+    void emit(std::vector<uint8_t>&& page, int64_t granule, bool boundary);
+    void release(bool eos);
+
+public:
+    oggCodec(codecSettings settings, bool store = false);
+    virtual ~oggCodec(void) { cleanup(); }
+    virtual void flush(void);
+    virtual std::string id() { return std::string("ogg"); }
+};
+
+oggCodec::oggCodec(codecSettings settings, bool store) : baseCodec(settings, "audio/ogg;codecs=vorbis", store) {
+    pcm.reset();
+    pcm = std::make_shared<byteBuffer>();
+}
+
+void oggCodec::cleanup(void) {
+    if (initialized) {
+        ogg_sync_clear(&sync);
+        ogg_stream_clear(&in);
+        vorbis_comment_clear(&comment);
+        vorbis_info_clear(&info);
+        initialized = false;
+    }
+}
+
+bool oggCodec::open(void) {
+    // what source has sent so far (including headers) still applies, only output restarts
+    if (!initialized) {
+        ogg_sync_init(&sync);
+        ogg_stream_init(&in, 0);
+        vorbis_info_init(&info);
+        vorbis_comment_init(&comment);
+        initialized = true;
+    }
+
+    drained = started = false;
+    base = -1;
+    chainStart = 0;
+    held.clear();
+    return true;
+}
+
+void oggCodec::flush(void) {
+    baseCodec::flush();
+    // partial pages and packets are from before the flush
+    if (initialized) {
+        ogg_sync_reset(&sync);
+        ogg_stream_reset(&in);
+    }
+    lastBlock = 0;
+    open();
+}
+
+void oggCodec::sourceStart(ogg_page& page) {
+    // a new source stream comes with its own headers and granules start over
+    ogg_stream_reset_serialno(&in, ogg_page_serialno(&page));
+    vorbis_comment_clear(&comment);
+    vorbis_info_clear(&info);
+    vorbis_info_init(&info);
+    vorbis_comment_init(&comment);
+    headerPackets = 0;
+    lastBlock = 0;
+    headers.clear();
+
+    // it is chained to what we've sent already
+    if (started) {
+        release(true);
+        chainStart = samples;
+        started = false;
+    }
+    base = -1;
+}
+
+void oggCodec::release(bool eos) {
+    if (held.empty()) return;
+    if (eos) held[5] |= 0x04;
+
+    ogg_page page = { held.data(), 27 + held[26], held.data() + 27 + held[26], (long) held.size() - 27 - held[26] };
+    ogg_page_checksum_set(&page);
+    encoded->write(held.data(), held.size());
+    held.clear();
+}
+
+void oggCodec::emit(std::vector<uint8_t>&& page, int64_t granule, bool boundary) {
+    bool bos = !started;
+
+    // header (27 bytes) is rewritten in-place, checksum is done once we know if it's the last
+    if (!started) {
+        // a chained stream must not re-use previous serial
+        for (uint32_t previous = serial; serial == previous;) serial = rand();
+        sequence = 0;
+        started = true;
+    }
+
+    page[5] = (page[5] & 0x01) | (bos ? 0x02 : 0);
+    for (int i = 0; i < 8; i++) page[6 + i] = (uint64_t) granule >> (i * 8);
+    for (int i = 0; i < 4; i++) page[14 + i] = serial >> (i * 8);
+    for (int i = 0; i < 4; i++) page[18 + i] = sequence >> (i * 8);
+    sequence++;
+
+    // previous page must be out to know where that one starts
+    release(false);
+    if (boundary) mark(samples);
+    held = std::move(page);
+}
+
+bool oggCodec::process(size_t bytes) {
+    bool starved = false;
+
+    while (encoded->space() >= std::max(minSpace, held.size() + 27 + 255 * 256) && (ssize_t)bytes > 0) {
+        ogg_page page;
+        int result = ogg_sync_pageout(&sync, &page);
+
+        // need more data, source's own framing is not aligned on what we are fed
+        if (result == 0) {
+            size_t len = pcm->used();
+            uint8_t* data = len ? pcm->readSpan(len) : NULL;
+            if (!data) {
+                starved = true;
+                break;
+            }
+            memcpy(ogg_sync_buffer(&sync, len), data, len);
+            ogg_sync_wrote(&sync, len);
+            pcm->commitRead(len);
+            continue;
+        }
+
+        // skipped garbage, we'll be re-synchronized on next page
+        if (result < 0) continue;
+
+        if (ogg_page_bos(&page)) sourceStart(page);
+        std::vector<uint8_t> copy(page.header_len + page.body_len);
+        memcpy(copy.data(), page.header, page.header_len);
+        memcpy(copy.data() + page.header_len, page.body, page.body_len);
+        bytes -= copy.size();
+
+        // count samples of packets that end in that page (first audio packet yields nothing)
+        uint64_t count = 0;
+        ogg_packet packet;
+        bool header = headerPackets < 3;
+        ogg_stream_pagein(&in, &page);
+        for (int result; (result = ogg_stream_packetout(&in, &packet)) != 0;) {
+            // a hole in source, next packet starts from scratch
+            if (result < 0) {
+                lastBlock = 0;
+                continue;
+            }
+            if (headerPackets < 3) {
+                if (vorbis_synthesis_headerin(&info, &comment, &packet) == 0) headerPackets++;
+                continue;
+            }
+            long block = vorbis_packet_blocksize(&info, &packet);
+            if (block <= 0) continue;
+            if (lastBlock) count += lastBlock / 4 + block / 4;
+            lastBlock = block;
+        }
+
+        if (header) {
+            // we can't send anything until we have all headers
+            headers.push_back(copy);
+            emit(std::move(copy), 0, false);
+            continue;
+        }
+
+        if (headerPackets < 3) continue;
+
+        // after a flush, a decoder needs headers again
+        if (!started) {
+            for (auto& header : headers) emit(std::vector<uint8_t>(header), 0, false);
+        }
+
+        // time starts where that page starts, which is what decoder will output from here
+        int64_t granule = ogg_page_granulepos(&page);
+        if (granule >= 0 && base < 0) base = std::max((int64_t) 0, granule - (int64_t) count);
+        if (granule >= 0) granule -= base;
+
+        // a page starts where previous one ended, unless it continues a packet
+        emit(std::move(copy), granule, !ogg_page_continued(&page));
+        if (granule >= 0) samples = chainStart + granule;
+    }
+
+    // pages might still be in sync even when there is nothing left to feed it
+    return starved;
+}
+
+bool oggCodec::drain(void) {
+    if (drained || encoded->space() < held.size()) return drained;
+    release(true);
+    return drained = true;
 }
 
 /****************************************************************************************
@@ -730,6 +1458,7 @@ std::unique_ptr<baseCodec> createCodec(codecSettings::type codec, codecSettings
     case codecSettings::VORBIS: return std::make_unique<vorbisCodec>(settings, store);
     case codecSettings::MP3: return std::make_unique<mp3Codec>(settings, store);
     case codecSettings::AAC: return std::make_unique<aacCodec>(settings, store);
+    case codecSettings::OGG: return std::make_unique<oggCodec>(settings, store);
     default: return nullptr;
     }
 }
@@ -2,38 +2,55 @@
 
 #include <vector>
 #include <inttypes.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <deque>
 #include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include "byteBuffer.h"
 
 /****************************************************************************************
- * Ring buffer
+ * Where frames start in encoded data (counted from the first byte produced after a flush)
+ * for a given sample position. Points are only kept every 'spacing' samples so that it
+ * stays small, lookups return the closest boundary at or before what is asked. When any
+ * frame is a boundary (raw pcm), positions in-between are exact
  */
-class byteBuffer {
+class seekIndex {
 private:
-    uint8_t* buffer;
-    uint8_t* read_p, * write_p, * wrap_p;
-    size_t size;
+    struct point {
+        uint64_t sample, offset;
+    };
     std::mutex mutex;
-    FILE* storage;
-
-    size_t _space(void) { return size - _used() - 1; }
-    size_t _used(void) { return write_p >= read_p ? write_p - read_p : size - (read_p - write_p); }
+    std::deque<point> points;
+    uint32_t rate = 44100, spacing = 44100 / 4;
+    size_t frameSize = 0;
+    int64_t first = -1;
 
 public:
-    byteBuffer(FILE* storage = NULL, size_t size = 4 * 1024 * 1024);
-    ~byteBuffer(void);
-    size_t read(uint8_t* dst, size_t max, size_t min = 0);
-    uint8_t* readInner(size_t& size);
-    bool write(const uint8_t* src, size_t size);
-    size_t space(void) { std::scoped_lock lock(mutex); return _space(); }
-    size_t used(void) { std::scoped_lock lock(mutex); return _used(); }
-    void flush(void) { std::scoped_lock lock(mutex); read_p = write_p = buffer; }
-    void lock(void) { mutex.lock(); }
-    void unlock(void) { mutex.unlock(); }
+    void setup(uint32_t rate, size_t frameSize);
+    void clear(void);
+    // take a copy of another index (the whole of it)
+    void assign(seekIndex& from);
+    // to keep it in a file and get it back (false when file is not right)
+    bool save(FILE* file);
+    bool load(FILE* file);
+    void mark(uint64_t sample, uint64_t offset);
+    // forget boundaries of data that is not available anymore
+    void trim(uint64_t offset);
+    // all return -1 (or false) when position is not indexed
+    int64_t offsetAt(uint32_t ms);
+    int64_t timeAt(uint64_t offset);
+    bool span(uint32_t& first, uint32_t& last);
+    // what is before first frame (container's headers), even when trimmed
+    int64_t headerSize(void) { std::scoped_lock lock(mutex); return first; }
 };
 
 class codecSettings {
 public:
-    typedef enum { MP3, AAC, VORBIS, OPUS, FLAC, WAV, PCM } type;
+    typedef enum { MP3, AAC, VORBIS, OPUS, FLAC, WAV, PCM, OGG } type;
     uint32_t rate = 44100;
     uint8_t channels = 2, size = 2;
     struct {
@@ -56,8 +73,18 @@ public:
  a set of full frames (i.e. a multiply of 16 bits L+R = 4 bytes
  */
 class baseCodec {
+    friend class encodePool;
+
 private:
     static uint32_t index;
+    // encoding job, only changed by pool (under its lock)
+    enum { IDLE, QUEUED, RUNNING, AGAIN, CLOSED } job = IDLE;
+    std::atomic<bool> finishing = false, finished = false;
+    // set-up has been done ahead
+    bool ready = false;
+
+    bool encode(void);
+    void finish(void);
 
 protected:
     codecSettings settings;
@@ -65,25 +92,85 @@ protected:
     uint32_t pcmBitrate;
     std::shared_ptr<byteBuffer> pcm, encoded;
     int total = 0;
+    // samples at next frame boundary and where encoded data started
+    uint64_t samples = 0;
+    size_t origin = 0;
+    std::shared_ptr<seekIndex> seek;
+    bool uniform = false;
+
+    void mark(uint64_t sample) { if (seek) seek->mark(sample, encoded->written() - origin); }
 
-    virtual void process(size_t bytes) { }
+    // encode up to 'bytes' from pcm, true when what is left is not enough to encode
+    virtual bool process(size_t bytes) { return true; }
+    // encoder outputs what it still holds, true when done
+    virtual bool drain(void) { return true; }
     virtual void cleanup() { }
+    // what does not depend on track (encoder set-up, stream headers), false if it fails
+    virtual bool open(void) { return true; }
+    // length of encoded track, negative when it can only be estimated (raw pcm by default)
+    virtual int64_t estimate(int64_t duration) { return duration ? (((int64_t)pcmBitrate * duration) / (8 * 1000)) & ~1LL : -INT64_MAX; }
 
 public:
     std::string mimeType;
     size_t icyInterval;
+    // who is listened to is encoded first, owner is told when there is fresh data
+    std::atomic<bool> playing = false;
+    std::function<void()> onEncoded;
 
     baseCodec(codecSettings settings, std::string mimeType, bool store = false);
     virtual ~baseCodec(void) { }
-    virtual bool pcmWrite(const uint8_t* data, size_t size) { return pcm->write(data, size); }
-    void unlock(void) { encoded->unlock(); }
+    virtual bool pcmWrite(const uint8_t* data, size_t size);
     bool isEmpty(void) { return encoded->used(); }
-    virtual void flush(void) { total = 0;  pcm->flush(); encoded->flush(); }
-    virtual int64_t initialize(int64_t duration) = 0;
+    virtual void flush(void);
+    void setOutput(std::shared_ptr<byteBuffer> buffer);
+    void setIndex(std::shared_ptr<seekIndex> index);
+    // set-up can be done before track is known, then initialize() only has to size it
+    void prepare(void) { ready = open(); }
+    // returns encoded length of track (see estimate), 0 if codec can't be set-up
+    virtual int64_t initialize(int64_t duration);
     virtual size_t read(uint8_t* dst, size_t size, size_t min = 0, bool drain = false);
-    virtual uint8_t* readInner(size_t& size, bool drain = false);
-    virtual void drain(void) { }
+    virtual uint8_t* readSpan(size_t& size, bool drain = false);
+    virtual void commitRead(size_t size);
+    // all that was fed has been encoded and is in output
+    bool isDrained(void) { return pcm == encoded || finished; }
     virtual std::string id();
 };
 
+/****************************************************************************************
+ * Workers shared by all codecs, so that encoding is neither paced by readers nor done by
+ * whoever feeds pcm. A codec is queued when it has something to do and a worker runs it
+ * for a slice then puts it back in line, so one codec is never run by two workers and a
+ * long track does not starve others. Codecs being listened to always go first. A codec
+ * can also split its slice in tasks that idle workers help with
+ */
+class encodePool {
+private:
+    struct batch {
+        std::vector<std::function<void()>>& tasks;
+        size_t next = 0, done = 0;
+    };
+
+    inline static std::mutex mutex;
+    inline static std::condition_variable wake, idle;
+    inline static std::deque<baseCodec*> queues[2];
+    inline static std::deque<batch*> batches;
+    // workers are detached so that a forced exit does not wait for them
+    inline static unsigned workers = 0;
+    inline static bool running = false;
+
+    static void worker(void);
+    static void runTask(batch* batch, std::unique_lock<std::mutex>& lock);
+
+public:
+    // 0 means one per core (up to 4)
+    inline static unsigned count = 0;
+    static unsigned size(void);
+    static void stop(void);
+    static void schedule(baseCodec* codec);
+    // when it returns, codec is neither queued nor running (and never will be once closed)
+    static void cancel(baseCodec* codec, bool close = false);
+    // caller runs tasks too, it returns when they are all done
+    static void run(std::vector<std::function<void()>>& tasks);
+};
+
 std::unique_ptr<baseCodec> createCodec(codecSettings::type codec, codecSettings settings, bool store = false);
\ No newline at end of file
@@ -58,6 +58,13 @@ void SaveConfig(char *name, void *ref, bool full) {
 	XMLUpdateNode(doc, root, false, "max_players", "%d", (int) glMaxDevices);
 	XMLUpdateNode(doc, root, false, "interface", glInterface);
 	XMLUpdateNode(doc, root, false, "credentials_path", glCredentialsPath);
+	XMLUpdateNode(doc, root, false, "cache_path", glCachePath);
+	XMLUpdateNode(doc, root, false, "track_cache", "%u", glTrackCache);
+	XMLUpdateNode(doc, root, false, "lookback", "%u", glLookback);
+	XMLUpdateNode(doc, root, false, "encoders", "%u", glEncoders);
+	XMLUpdateNode(doc, root, false, "track_cache_path", glTrackCachePath);
+	XMLUpdateNode(doc, root, false, "track_cache_disk", "%u", glTrackCacheDisk);
+	XMLUpdateNode(doc, root, false, "io_uring", "%d", glIoUring);
 	XMLUpdateNode(doc, root, false, "credentials", "%d", glCredentials);
 	XMLUpdateNode(doc, root, false, "ports", "%hu:%hu", glPortBase, glPortRange);
 
@@ -159,6 +166,13 @@ static void LoadGlobalItem(char *name, char *val) {
 	if (!strcmp(name, "ports")) sscanf(val, "%hu:%hu", &glPortBase, &glPortRange);
 	if (!strcmp(name, "credentials")) glCredentials = atol(val);
 	if (!strcmp(name, "credentials_path")) strncpy(glCredentialsPath, val, sizeof(glCredentialsPath) - 1);
+	if (!strcmp(name, "cache_path")) strncpy(glCachePath, val, sizeof(glCachePath) - 1);
+	if (!strcmp(name, "track_cache")) glTrackCache = atol(val);
+	if (!strcmp(name, "lookback")) glLookback = atol(val);
+	if (!strcmp(name, "encoders")) glEncoders = atol(val);
+	if (!strcmp(name, "track_cache_path")) strncpy(glTrackCachePath, val, sizeof(glTrackCachePath) - 1);
+	if (!strcmp(name, "track_cache_disk")) glTrackCacheDisk = atol(val);
+	if (!strcmp(name, "io_uring")) glIoUring = atol(val);
  }
 
 /*----------------------------------------------------------------------------*/
@@ -0,0 +1,201 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "sampleKernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define HAS_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__)
+// AVX2 is compiled for its own functions only and used if CPU says so
+#define HAS_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON)
+#define HAS_NEON
+#include <arm_neon.h>
+#endif
+
+// multiply by inverse so that all versions round the same way
+static constexpr float scale = 1.0f / INT16_MAX;
+
+/****************************************************************************************
+ * Plain C, also used for what does not fill a vector
+ */
+
+static void widenC(const int16_t* src, int32_t* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) dst[i] = src[i];
+}
+
+static void deinterleaveC(const int16_t* src, float* left, float* right, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        left[i] = src[2 * i] * scale;
+        right[i] = src[2 * i + 1] * scale;
+    }
+}
+
+static void byteswapC(uint16_t* data, size_t count) {
+    for (size_t i = 0; i < count; i++) data[i] = (uint16_t) ((data[i] >> 8) | (data[i] << 8));
+}
+
+/****************************************************************************************
+ * SSE2 (always there on x86-64)
+ */
+
+#ifdef HAS_SSE2
+static void widenSSE2(const int16_t* src, int32_t* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+        // put each sample in the upper half of a 32 bits lane and shift it down with sign
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+        _mm_storeu_si128((__m128i*) (dst + i + 4), _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+    }
+    widenC(src + i, dst + i, count - i);
+}
+
+static void deinterleaveSSE2(const int16_t* src, float* left, float* right, size_t count) {
+    const __m128 k = _mm_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (src + 2 * i));
+        __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+        __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+        _mm_storeu_ps(left + i, _mm_mul_ps(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)), k));
+        _mm_storeu_ps(right + i, _mm_mul_ps(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)), k));
+    }
+    deinterleaveC(src + 2 * i, left + i, right + i, count - i);
+}
+
+static void byteswapSSE2(uint16_t* data, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+        _mm_storeu_si128((__m128i*) (data + i), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+    }
+    byteswapC(data + i, count - i);
+}
+#endif
+
+/****************************************************************************************
+ * AVX2
+ */
+
+#ifdef HAS_AVX2
+__attribute__((target("avx2")))
+static void widenAVX2(const int16_t* src, int32_t* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (src + i + 8));
+        _mm256_storeu_si256((__m256i*) (dst + i), _mm256_cvtepi16_epi32(a));
+        _mm256_storeu_si256((__m256i*) (dst + i + 8), _mm256_cvtepi16_epi32(b));
+    }
+    widenSSE2(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void deinterleaveAVX2(const int16_t* src, float* left, float* right, size_t count) {
+    const __m256 k = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 a = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (src + 2 * i))));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (src + 2 * i + 8))));
+        // shuffle works per 128 bits lane, so 64 bits pairs have to be put back in order
+        __m256 l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        l = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(l), _MM_SHUFFLE(3, 1, 2, 0)));
+        r = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r), _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm256_storeu_ps(left + i, _mm256_mul_ps(l, k));
+        _mm256_storeu_ps(right + i, _mm256_mul_ps(r, k));
+    }
+    deinterleaveSSE2(src + 2 * i, left + i, right + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void byteswapAVX2(uint16_t* data, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (data + i));
+        _mm256_storeu_si256((__m256i*) (data + i), _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8)));
+    }
+    byteswapSSE2(data + i, count - i);
+}
+#endif
+
+/****************************************************************************************
+ * NEON (only when compiler targets it, there is no runtime check on 32 bits ARM)
+ */
+
+#ifdef HAS_NEON
+static void widenNEON(const int16_t* src, int32_t* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t v = vld1q_s16(src + i);
+        vst1q_s32(dst + i, vmovl_s16(vget_low_s16(v)));
+        vst1q_s32(dst + i + 4, vmovl_s16(vget_high_s16(v)));
+    }
+    widenC(src + i, dst + i, count - i);
+}
+
+static void deinterleaveNEON(const int16_t* src, float* left, float* right, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        // de-interleaving load does the hard part
+        int16x4x2_t v = vld2_s16(src + 2 * i);
+        vst1q_f32(left + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(v.val[0])), scale));
+        vst1q_f32(right + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(v.val[1])), scale));
+    }
+    deinterleaveC(src + 2 * i, left + i, right + i, count - i);
+}
+
+static void byteswapNEON(uint16_t* data, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint8x16_t v = vld1q_u8((const uint8_t*) (data + i));
+        vst1q_u8((uint8_t*) (data + i), vrev16q_u8(v));
+    }
+    byteswapC(data + i, count - i);
+}
+#endif
+
+/****************************************************************************************
+ * Selection, done once at startup
+ */
+
+static sampleKernels::set pickKernels() {
+#ifdef HAS_AVX2
+    if (__builtin_cpu_supports("avx2")) return { "avx2", widenAVX2, deinterleaveAVX2, byteswapAVX2 };
+#endif
+#if defined(HAS_SSE2)
+    return { "sse2", widenSSE2, deinterleaveSSE2, byteswapSSE2 };
+#elif defined(HAS_NEON)
+    return { "neon", widenNEON, deinterleaveNEON, byteswapNEON };
+#else
+    return { "c", widenC, deinterleaveC, byteswapC };
+#endif
+}
+
+static const sampleKernels::set selected = pickKernels();
+
+const char* sampleKernels::name = selected.name;
+void (*sampleKernels::widen)(const int16_t*, int32_t*, size_t) = selected.widen;
+void (*sampleKernels::deinterleave)(const int16_t*, float*, float*, size_t) = selected.deinterleave;
+void (*sampleKernels::byteswap)(uint16_t*, size_t) = selected.byteswap;
+
+std::vector<sampleKernels::set> sampleKernels::available(void) {
+    std::vector<set> sets = { { "c", widenC, deinterleaveC, byteswapC } };
+#ifdef HAS_SSE2
+    sets.push_back({ "sse2", widenSSE2, deinterleaveSSE2, byteswapSSE2 });
+#endif
+#ifdef HAS_AVX2
+    if (__builtin_cpu_supports("avx2")) sets.push_back({ "avx2", widenAVX2, deinterleaveAVX2, byteswapAVX2 });
+#endif
+#ifdef HAS_NEON
+    sets.push_back({ "neon", widenNEON, deinterleaveNEON, byteswapNEON });
+#endif
+    return sets;
+}
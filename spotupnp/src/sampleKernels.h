@@ -0,0 +1,37 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/****************************************************************************************
+ * Sample conversions that codecs run on every buffer. Implementation is picked once for
+ * the CPU we run on (AVX2 or SSE2 on x86, NEON on ARM when built for it, plain C otherwise)
+ * and all of them give exactly the same result. Pointers don't need to be aligned
+ */
+class sampleKernels {
+public:
+    struct set {
+        const char* name;
+        void (*widen)(const int16_t* src, int32_t* dst, size_t count);
+        void (*deinterleave)(const int16_t* src, float* left, float* right, size_t count);
+        void (*byteswap)(uint16_t* data, size_t count);
+    };
+
+    // signed 16 bits to 32 bits, count is in samples
+    static void (*widen)(const int16_t* src, int32_t* dst, size_t count);
+    // interleaved 16 bits stereo to one float [-1..1] buffer per channel, count is in frames
+    static void (*deinterleave)(const int16_t* src, float* left, float* right, size_t count);
+    // swap endianness of 16 bits samples in place, count is in samples
+    static void (*byteswap)(uint16_t* data, size_t count);
+    // what has been picked, for logging
+    static const char* name;
+    // all that this CPU can run, plain C (the reference) first
+    static std::vector<set> available(void);
+};
@@ -37,6 +37,7 @@ extern "C" {
 #include "spotify.h"
 #include "metadata.h"
 #include "codecs.h"
+#include "pcmLookback.h"
 
 /****************************************************************************************
  * Encapsulate pthread mutexes into basic_lockable
@@ -90,7 +91,7 @@ private:
     uint64_t lastTimeStamp;
     uint32_t lastPosition;
 
-    unsigned index = 0;
+    std::atomic<unsigned> index = 0;
 
     std::string codec, id;
     struct in_addr addr;
@@ -102,6 +103,8 @@ private:
 
     std::deque<std::shared_ptr<HTTPstreamer>> streamers;
     std::shared_ptr<HTTPstreamer> player;
+    std::unique_ptr<streamerPool> spares;
+    pcmLookback lookback;
 
     bool flow;
     int cacheMode;
@@ -113,6 +116,8 @@ private:
     std::unique_ptr<cspot::SpircHandler> spirc;
 
     size_t writePCM(uint8_t* data, size_t bytes, std::string_view trackId);
+    size_t writeOgg(uint8_t* data, size_t bytes, std::string_view trackId);
+    bool replayPCM(void);
     auto postHandler(struct mg_connection* conn);
     void eventHandler(std::unique_ptr<cspot::SpircHandler::Event> event);
     void trackHandler(std::string_view trackUnique);
@@ -121,6 +126,7 @@ private:
     void runTask();
 public:
     inline static std::string username = "", password = "";
+    inline static uint32_t lookbackSize = 0;
 
     CSpotPlayer(char* name, char* id, char *credentials, struct in_addr addr, AudioFormat audio, char* codec, bool flow,
         int64_t contentLength, int cacheMode, struct shadowPlayer* shadow, pthread_mutex_t* mutex);
@@ -136,8 +142,20 @@ CSpotPlayer::CSpotPlayer(char* name, char* id, char *credentials, struct in_addr
         48 * 1024, 0, 0),
     clientConnected(1), codec(codec), id(id), addr(addr), flow(flow),
     name(name), credentials(credentials), format(format), shadow(shadow), 
-    playerMutex(mutex), cacheMode(cacheMode) {
+    playerMutex(mutex), cacheMode(cacheMode), lookback(pcmLookback::bytes(lookbackSize * 1000)) {
     this->contentLength = (flow && contentLength == HTTP_CL_REAL) ? HTTP_CL_NONE : contentLength;
+#ifndef CSPOT_OGG_PAGES
+    // passthrough needs cspot to hand us the Ogg pages it downloads, otherwise it's re-encoding
+    if (this->codec.find("ogg") != std::string::npos || this->codec.find("passthrough") != std::string::npos) {
+        auto rate = this->codec.find(':');
+        this->codec = "vorbis" + (rate != std::string::npos ? this->codec.substr(rate) : ":160");
+        CSPOT_LOG(info, "player <%s> can't relay Ogg pages, using %s", this->name.c_str(), this->codec.c_str());
+    }
+#endif
+    // once we play, next streamer is ready so a track change only has to tell it what it streams
+    spares = std::make_unique<streamerPool>([this] {
+        return std::make_shared<HTTPstreamer>(this->addr, this->id, index++, this->codec, this->flow, this->cacheMode, nullptr, nullptr);
+    });
 }
 
 CSpotPlayer::~CSpotPlayer() {
@@ -178,6 +196,13 @@ size_t CSpotPlayer::writePCM(uint8_t* data, size_t bytes, std::string_view track
 #endif
         CSPOT_LOG(info, "trackUniqueId update %s => %s", streamTrackUnique.c_str(), trackUnique.data());
         streamTrackUnique = trackUnique;
+
+        // a track played again (previous, repeat) might be in lookback
+        uint32_t position = streamers.empty() ? startOffset : 0;
+        if (size_t cached = lookback.start(trackUnique, pcmLookback::bytes(position))) {
+            CSPOT_LOG(info, "replaying %zu bytes from lookback at %u", cached, position);
+        }
+
         trackHandler(trackUnique);
     }
 
@@ -185,8 +210,52 @@ size_t CSpotPlayer::writePCM(uint8_t* data, size_t bytes, std::string_view track
     if (flushed) return bytes;
 #endif
 
-    if (!streamers.empty() && streamers.front()->feedPCMFrames(data, bytes)) return bytes;
-    else return 0;
+    // replay first and then drop what decoder sends again
+    if (!replayPCM()) return 0;
+    if (size_t dropped = lookback.drop(bytes)) return dropped;
+
+    if (streamers.empty() || !streamers.front()->feedPCMFrames(data, bytes)) return 0;
+
+    lookback.write(data, bytes);
+    return bytes;
+}
+
+size_t CSpotPlayer::writeOgg(uint8_t* data, size_t bytes, std::string_view trackUnique) {
+    // same as PCM except there is no lookback as this is not a decoder's output
+    if (!isRunning || isPaused) return 0;
+
+#ifndef SMART_FLUSH
+    if (flushed) return 0;
+#endif
+
+    std::lock_guard lock(playerMutex);
+
+    if (streamTrackUnique != trackUnique) {
+        if (streamers.size() > 1) return 0;
+#ifdef SMART_FLUSH
+        flushed = false;
+#endif
+        CSPOT_LOG(info, "trackUniqueId update %s => %s", streamTrackUnique.c_str(), trackUnique.data());
+        streamTrackUnique = trackUnique;
+        trackHandler(trackUnique);
+    }
+
+#ifdef SMART_FLUSH
+    if (flushed) return bytes;
+#endif
+
+    if (streamers.empty() || !streamers.front()->feedOggPages(data, bytes)) return 0;
+    return bytes;
+}
+
+bool CSpotPlayer::replayPCM(void) {
+    // player's mutex is already locked
+    for (size_t bytes = SIZE_MAX;; bytes = SIZE_MAX) {
+        auto data = lookback.replay(bytes);
+        if (!data) return true;
+        if (streamers.empty() || !streamers.front()->feedPCMFrames(data, bytes)) return false;
+        lookback.replayed(bytes);
+    }
 }
 
 auto CSpotPlayer::postHandler(struct mg_connection* conn) {
@@ -240,7 +309,7 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
     
     // switch current streamer to draining state except in flow mode
     if (!streamers.empty() && !flow) {
-        streamers.front()->state = HTTPstreamer::DRAINING;
+        streamers.front()->drain();
         CSPOT_LOG(info, "draining track %s", streamers.front()->streamId.c_str());
     }
       
@@ -249,9 +318,9 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
 
     // create a new streamer an run it, unless in flow mode
     if (streamers.empty() || !flow) {
-        auto streamer = std::make_shared<HTTPstreamer>(addr, id, index++, codec, flow, contentLength, cacheMode, 
-                                                       newTrackInfo, trackUnique, streamers.empty() ? -startOffset : 0,
-                                                       nullptr, nullptr);
+        // in flow mode, that streamer is the only one until we are stopped
+        auto streamer = spares->take(!flow);
+        streamer->assign(newTrackInfo, trackUnique, streamers.empty() ? -startOffset : 0, contentLength);
 
         CSPOT_LOG(info, "loading with id %s", streamer->streamId.c_str());
 
@@ -269,8 +338,10 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
         // play unless already paused
         if (!isPaused) shadowRequest(shadow, SPOT_PLAY);
  
+        // only the one that plays (or is about to) has priority for encoding
+        streamer->setPlaying(streamers.empty());
         streamers.push_front(streamer);
-        streamer->startTask();
+        streamer->start();
     } else {
         CSPOT_LOG(info, "flow track of duration %d will start at %u", newTrackInfo.duration, flowMarkers.front());
         player->trackInfo = newTrackInfo;
@@ -357,14 +428,22 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
 
         // we might not have detected track yet but we don't want to re-detect
         auto streamer = player ? player : streamers.back();
-        streamer->flush();
-        streamer->offset = -std::get<int>(event->data);
-        CSPOT_LOG(info, "seeking from streamer %s at %u", streamer->streamId.c_str(), -streamer->offset);
+        int position = std::get<int>(event->data);
+
+        // when we have it, player restarts from cache and encoder continues, otherwise start over
+        bool cached = streamer->seek(position);
+        if (!cached) {
+            streamer->flush();
+            streamer->offset = -position;
+        }
+
+        CSPOT_LOG(info, "seeking from streamer %s at %u%s", streamer->streamId.c_str(), -streamer->offset, cached ? " (cached)" : "");
 
         // re-insert streamer whether it was player or not
         streamers.clear();
         flowMarkers.clear();
         streamers.push_front(streamer);
+        streamer->setPlaying(true);
         streamTrackUnique = streamer->trackUnique;
         lastPosition = 0;
         
@@ -372,7 +451,7 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
 
         // be careful that streamer's offset is negative
         metadata_t metadata = { 0 };
-        streamer->setContentLength(contentLength);
+        if (!cached) streamer->setContentLength(contentLength);
 
         // in flow mode, need to restore trackInfo from what was the most current
         if (flow) {
@@ -387,11 +466,17 @@ void CSpotPlayer::trackHandler(std::string_view trackUnique) {
 
         shadowRequest(shadow, SPOT_LOAD, streamer->getStreamUrl().c_str(), &metadata, -streamer->offset);
         if (!isPaused) shadowRequest(shadow, SPOT_PLAY);
+
+        // decoder restarts from there, but what lookback has can be fed right away
+        if (lookback.start(streamTrackUnique, pcmLookback::bytes(position))) {
+            CSPOT_LOG(info, "seeking to %d from lookback", position);
+            replayPCM();
+        }
         break;
     }
     case cspot::SpircHandler::EventType::DEPLETED:
         playlistEnd = true;
-        streamers.front()->state = HTTPstreamer::DRAINING;
+        streamers.front()->drain();
         CSPOT_LOG(info, "playlist ended, no track left to play");
         break;
     case cspot::SpircHandler::EventType::VOLUME:
@@ -468,10 +553,10 @@ void notify(CSpotPlayer *self, enum shadowEvent event, va_list args) {
         auto url = std::string(va_arg(args, char*));
 
         // nothing to do if we are already the active player
-        if (self->streamers.empty() || (self->player && url.find(self->player->getStreamUrl()) != std::string::npos)) return;    
+        if (self->streamers.empty() || (self->player && self->player->matchUrl(url))) return;    
 
         // remove previous streamers till we reach new url (should be only one)
-        while (url.find(self->streamers.back()->getStreamUrl()) == std::string::npos) {
+        while (!self->streamers.back()->matchUrl(url)) {
             self->streamers.pop_back();
             // we should NEVER be here
             if (self->streamers.empty()) return;
@@ -479,6 +564,7 @@ void notify(CSpotPlayer *self, enum shadowEvent event, va_list args) {
 
         // now we can set current player
         self->player = self->streamers.back();
+        self->player->setPlaying(true);
 
         // finally, get ready for time position and inform spotify that we are playing
         self->lastPosition = 0;
@@ -518,6 +604,8 @@ void CSpotPlayer::disconnect(bool abort) {
     shadowRequest(shadow, SPOT_STOP);
     streamers.clear();
     player.reset();
+    // an idle player does not need to keep a streamer aside
+    spares->release();
 }
 
 bool getMetaForUrl(CSpotPlayer* self, const std::string url, metadata_t* metadata) {
@@ -606,6 +694,13 @@ void CSpotPlayer::runTask() {
                 [this](uint8_t* data, size_t bytes, std::string_view trackId) {
                     return writePCM(data, bytes, trackId);
                 });
+#ifdef CSPOT_OGG_PAGES
+            // pages as they are downloaded, from where a track starts or is seeked to
+            spirc->getTrackPlayer()->setOggCallback(
+                [this](uint8_t* data, size_t bytes, std::string_view trackId) {
+                    return writeOgg(data, bytes, trackId);
+                });
+#endif
 
             // set event (PLAY, VOLUME...) handler
             spirc->setEventHandler(
@@ -639,18 +734,28 @@ void CSpotPlayer::runTask() {
  * C interface functions
  */
 
-void spotOpen(uint16_t portBase, uint16_t portRange, char *username, char* password) {
+void spotOpen(uint16_t portBase, uint16_t portRange, char* cachePath, uint32_t trackCacheSize, char* trackCachePath, uint32_t trackCacheDisk, bool ioUring, uint32_t lookback, unsigned encoders, char *username, char* password) {
     if (!bell::bellGlobalLogger) {
         bell::setDefaultLogger();
         bell::enableTimestampLogging(true);
     }
     HTTPstreamer::portBase = portBase;
     if (portRange) HTTPstreamer::portRange = portRange;
+    if (cachePath) fileBuffer::path = cachePath;
+    trackCache::capacity = (size_t) trackCacheSize * 1024 * 1024;
+    trackCache::open(trackCachePath ? trackCachePath : "", (size_t) trackCacheDisk * 1024 * 1024);
+    HTTPreactor::useUring = ioUring;
+    encodePool::count = encoders;
+    CSpotPlayer::lookbackSize = lookback;
     if (username) CSpotPlayer::username = username;
     if (password) CSpotPlayer::password = password;
 }
 
 void spotClose(void) {
+    encodePool::stop();
+    trackCache::close();
+    HTTPlistener::closeAll();
+    HTTPreactor::closeAll();
     delete bell::bellGlobalLogger;
 }
 
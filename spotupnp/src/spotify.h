@@ -39,7 +39,7 @@ struct spotPlayer* spotCreatePlayer(char* name, char* id, char *credentials, str
 								    int64_t contentLength, int cacheMode, struct shadowPlayer* shadow, pthread_mutex_t *mutex);
 void spotDeletePlayer(struct spotPlayer *spotPlayer);
 bool spotGetMetaForUrl(struct spotPlayer* spotPlayer, const char* url, metadata_t* metadata);
-void spotOpen(uint16_t portBase, uint16_t portRange, char* username, char *password);
+void spotOpen(uint16_t portBase, uint16_t portRange, char* cachePath, uint32_t trackCacheSize, char* trackCachePath, uint32_t trackCacheDisk, bool ioUring, uint32_t lookback, unsigned encoders, char* username, char *password);
 void spotClose(void);
 void spotNotify(struct spotPlayer* spotPlayer, enum shadowEvent event, ...);
 
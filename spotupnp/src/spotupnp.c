@@ -53,6 +53,13 @@ int					glMaxDevices = 32;
 uint16_t			glPortBase, glPortRange;
 char				glInterface[128] = "?";
 char				glCredentialsPath[STR_LEN];
+char				glCachePath[STR_LEN];
+uint32_t			glTrackCache = 64;
+uint32_t			glLookback = 0;
+uint32_t			glEncoders = 0;
+char				glTrackCachePath[STR_LEN];
+uint32_t			glTrackCacheDisk = 2048;
+bool				glIoUring;
 bool				glCredentials;
 
 log_level	main_loglevel = lINFO;
@@ -146,7 +153,8 @@ static char usage[] =
 		   "  -P <password>        Spotify password\n"
 		   "  -l                   send continuous audio stream instead of separated tracks\n"
 		   "  -g -3|-2|-1|0|<n>    HTTP content-length mode (-3:chunked(*), -2:if known, -1:none, 0:fixed, <n> your value)\n"
-		   "  -A 0|1|2		       HTTP caching mode (0=memory, 1=memory but claim it's infinite(*), 2=on disk)\n"		
+		   "  -A 0|1|2|3	       HTTP caching mode (0=memory, 1=memory but claim it's infinite(*), 2=on disk, 3=memory with history on disk)\n"		
+		   "  -C <path>            directory for HTTP disk cache (default is system's temporary directory)\n"
 		   "  -e                   disable gapless\n"
 		   "  -u <version>         set the maximum UPnP version for search (default 1)\n"
 		   "  -N <format>          transform device name using C format (%s=name)\n"
@@ -1107,17 +1115,33 @@ static bool AddMRDevice(struct sMR* Device, char* UDN, IXML_Document* DescDoc, c
 	if (!*Device->Config.Name) sprintf(Device->Config.Name, glNameFormat, friendlyName);
 	queue_init(&Device->ActionQueue, false, NULL);
 
+	// Ogg pages are relayed as Spotify sends them, so player must take audio/ogg or it's flac
+	if (strcasestr(Device->Config.Codec, "ogg") || strcasestr(Device->Config.Codec, "passthrough")) {
+		char* Sink = GetProtocolInfo(Device);
+		if (!Sink || !strcasestr(Sink, "audio/ogg")) {
+			LOG_WARN("[%p]: player does not accept audio/ogg, using flac instead of %s", Device, Device->Config.Codec);
+			strcpy(Device->Config.Codec, "flac");
+		}
+		NFREE(Sink);
+	}
+
 	char* MimeType;
 	if (!strcasecmp(Device->Config.Codec, "pcm")) MimeType = "audio/L16;rate=44100;channels=2";
 	else if (!strcasecmp(Device->Config.Codec, "wav")) MimeType = "audio/wav";
 	else if (strcasestr(Device->Config.Codec, "mp3")) MimeType = "audio/mepg";
 	else if (strcasestr(Device->Config.Codec, "opus")) MimeType = "audio/ogg";
 	else if (strcasestr(Device->Config.Codec, "vorbis")) MimeType = "audio/ogg";
+	else if (strcasestr(Device->Config.Codec, "ogg") || strcasestr(Device->Config.Codec, "passthrough")) MimeType = "audio/ogg";
 	else if (strcasestr(Device->Config.Codec, "aac")) MimeType = "audio/aac";
 	else MimeType = "audio/flac";
 
-	// we cheat a bit as we allow cache to pretend to be infinite
-	char* DLNA_ORG = makeDLNA_ORG(Device->Config.Codec, Device->Config.CacheMode != HTTP_CACHE_MEM, Device->Config.Flow);
+	// must match what streamer's cache claims (no disk tier on Windows, except plain file in non-flow)
+#ifdef _WIN32
+	bool fullCache = Device->Config.CacheMode == HTTP_CACHE_INFINITE || (Device->Config.CacheMode == HTTP_CACHE_DISK && !Device->Config.Flow);
+#else
+	bool fullCache = Device->Config.CacheMode != HTTP_CACHE_MEM;
+#endif
+	char* DLNA_ORG = makeDLNA_ORG(Device->Config.Codec, fullCache, Device->Config.Flow);
 	sprintf(Device->ProtocolInfo, "http-get:*:%s:%s", MimeType, DLNA_ORG);
 	free(DLNA_ORG);
 
@@ -1231,7 +1255,7 @@ static bool Start(bool cold) {
 	glPort = UpnpGetServerPort();
 
 	// start cspot
-	spotOpen(glPortBase, glPortRange, glUserName, glPassword);
+	spotOpen(glPortBase, glPortRange, glCachePath, glTrackCache, glTrackCachePath, glTrackCacheDisk, glIoUring, glLookback, glEncoders, glUserName, glPassword);
 
 	LOG_INFO("Binding to %s:%hu", inet_ntoa(glHost), glPort);
 
@@ -1350,7 +1374,7 @@ bool ParseArgs(int argc, char **argv) {
 
 	while (optind < argc && strlen(argv[optind]) >= 2 && argv[optind][0] == '-') {
 		char *opt = argv[optind] + 1;
-		if (strstr("abxdpifmnocugrJUPNA", opt) && optind < argc - 1) {
+		if (strstr("abxdpifmnocugrJUPNAC", opt) && optind < argc - 1) {
 			optarg = argv[optind + 1];
 			optind += 2;
 		} else if (strstr("tzZIklej", opt) || opt[0] == '-') {
@@ -1377,6 +1401,9 @@ bool ParseArgs(int argc, char **argv) {
 		case 'J':
 			strncpy(glCredentialsPath, optarg, sizeof(glCredentialsPath) - 1);
 			break;
+		case 'C':
+			strncpy(glCachePath, optarg, sizeof(glCachePath) - 1);
+			break;
 		case 'j':
 			glCredentials = true;
 			break;
@@ -107,6 +107,13 @@ extern int					glMaxDevices;
 extern char					glInterface[128];
 extern unsigned short		glPortBase, glPortRange;
 extern char					glCredentialsPath[STR_LEN];
+extern char					glCachePath[STR_LEN];
+extern uint32_t				glTrackCache;
+extern uint32_t				glLookback;
+extern uint32_t				glEncoders;
+extern char					glTrackCachePath[STR_LEN];
+extern uint32_t				glTrackCacheDisk;
+extern bool					glIoUring;
 extern bool					glCredentials;
 
 int MasterHandler(Upnp_EventType EventType, const void *Event, void *Cookie);
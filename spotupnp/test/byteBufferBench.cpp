@@ -0,0 +1,102 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+#include "byteBuffer.h"
+
+/****************************************************************************************
+ * One producer and one consumer hammering a ring with small chunks, which is what pcm feed
+ * and encoder (or encoder and HTTP sender) do. It compares byteBuffer with the ring it has
+ * replaced, where every call takes a mutex. Data is checked so that a broken ring shows
+ */
+
+class mutexBuffer {
+private:
+    std::vector<uint8_t> buffer;
+    size_t read_p = 0, write_p = 0;
+    std::mutex mutex;
+
+    size_t _used(void) { return write_p >= read_p ? write_p - read_p : buffer.size() - (read_p - write_p); }
+
+public:
+    mutexBuffer(size_t size) : buffer(size) { }
+
+    bool write(const uint8_t* src, size_t size) {
+        std::scoped_lock lock(mutex);
+        if (size > buffer.size() - _used() - 1) return false;
+        size_t cont = std::min(size, buffer.size() - write_p);
+        memcpy(buffer.data() + write_p, src, cont);
+        memcpy(buffer.data(), src + cont, size - cont);
+        write_p = (write_p + size) % buffer.size();
+        return true;
+    }
+
+    size_t read(uint8_t* dst, size_t size) {
+        std::scoped_lock lock(mutex);
+        size = std::min(size, _used());
+        size_t cont = std::min(size, buffer.size() - read_p);
+        memcpy(dst, buffer.data() + read_p, cont);
+        memcpy(dst + cont, buffer.data(), size - cont);
+        read_p = (read_p + size) % buffer.size();
+        return size;
+    }
+
+    size_t used(void) { std::scoped_lock lock(mutex); return _used(); }
+};
+
+template <typename Buffer> static bool run(const char* name, Buffer& buffer, size_t chunk, size_t total) {
+    bool valid = true;
+    auto start = std::chrono::steady_clock::now();
+    size_t fullCalls = 0, emptyCalls = 0;
+
+    // byte at position p is (uint8_t) p, so any window of the pattern is what is expected
+    std::vector<uint8_t> pattern(chunk + 256);
+    for (size_t i = 0; i < pattern.size(); i++) pattern[i] = (uint8_t) i;
+
+    std::thread producer([&] {
+        for (size_t sent = 0; sent < total;) {
+            if (buffer.write(pattern.data() + sent % 256, chunk)) sent += chunk;
+            else fullCalls++;
+        }
+    });
+
+    std::vector<uint8_t> data(chunk);
+    for (size_t received = 0; received < total;) {
+        size_t n = buffer.read(data.data(), chunk);
+        if (!n) emptyCalls++;
+        valid &= !memcmp(data.data(), pattern.data() + received % 256, n);
+        received += n;
+    }
+
+    producer.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-10s chunk %6zu: %8.0f MB/s %10.0f chunks/s (full:%zu empty:%zu)%s\n", name, chunk,
+           total / seconds / (1024 * 1024), total / chunk / seconds, fullCalls, emptyCalls, valid ? "" : " CORRUPTED");
+    return valid;
+}
+
+int main(void) {
+    const size_t size = 4 * 1024 * 1024, total = 1024 * 1024 * 1024;
+    bool valid = true;
+
+    // from one pcm frame to what a codec pass produces
+    for (size_t chunk : { 4, 64, 1024, 4096, 16384 }) {
+        size_t bytes = std::min(total, chunk * 16 * 1024 * 1024 / 4);
+        byteBuffer lockFree(NULL, size);
+        mutexBuffer locked(size);
+        valid &= run("lock-free", lockFree, chunk, bytes);
+        valid &= run("mutex", locked, chunk, bytes);
+    }
+
+    return valid ? 0 : 1;
+}
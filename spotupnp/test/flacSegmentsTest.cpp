@@ -0,0 +1,171 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#include "Logger.h"
+#include "codecs.h"
+#include "FLAC/stream_encoder.h"
+#include "FLAC/stream_decoder.h"
+
+/****************************************************************************************
+ * FLAC encoded in segments by several workers, whose frame number and CRCs are rewritten,
+ * against one plain libFLAC encoder, at every level. Both are decoded by libFLAC that checks
+ * CRCs, frames must be numbered in sequence and decoded samples must be the input, exactly.
+ * Throughput of both is printed
+ */
+
+struct decoded {
+    std::vector<int16_t> samples;
+    uint64_t frames = 0;
+    unsigned errors = 0;
+    bool sequence = true;
+};
+
+static decoded decode(const std::vector<uint8_t>& stream) {
+    struct context {
+        const std::vector<uint8_t>& stream;
+        size_t at = 0;
+        decoded result;
+    } ctx = { stream };
+
+    auto read = [](const FLAC__StreamDecoder*, FLAC__byte buffer[], size_t* bytes, void* data) {
+        auto ctx = (context*) data;
+        *bytes = std::min(*bytes, ctx->stream.size() - ctx->at);
+        memcpy(buffer, ctx->stream.data() + ctx->at, *bytes);
+        ctx->at += *bytes;
+        return *bytes ? FLAC__STREAM_DECODER_READ_STATUS_CONTINUE : FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+    };
+
+    auto write = [](const FLAC__StreamDecoder*, const FLAC__Frame* frame, const FLAC__int32* const buffer[], void* data) {
+        auto ctx = (context*) data;
+        auto& header = frame->header;
+        if (header.number_type != FLAC__FRAME_NUMBER_TYPE_FRAME_NUMBER || header.number.frame_number != ctx->result.frames) ctx->result.sequence = false;
+        ctx->result.frames++;
+        for (unsigned i = 0; i < header.blocksize; i++) {
+            for (unsigned c = 0; c < header.channels; c++) ctx->result.samples.push_back(buffer[c][i]);
+        }
+        return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+    };
+
+    auto error = [](const FLAC__StreamDecoder*, FLAC__StreamDecoderErrorStatus status, void* data) {
+        ((context*) data)->result.errors++;
+    };
+
+    auto decoder = FLAC__stream_decoder_new();
+    FLAC__stream_decoder_set_md5_checking(decoder, false);
+    FLAC__stream_decoder_init_stream(decoder, read, NULL, NULL, NULL, NULL, write, NULL, error, &ctx);
+    FLAC__stream_decoder_process_until_end_of_stream(decoder);
+    FLAC__stream_decoder_delete(decoder);
+    return ctx.result;
+}
+
+static std::vector<uint8_t> reference(const std::vector<int16_t>& pcm, int level, double& seconds) {
+    std::vector<uint8_t> stream;
+    auto write = [](const FLAC__StreamEncoder*, const FLAC__byte buffer[], size_t bytes, unsigned, unsigned, void* data) {
+        auto stream = (std::vector<uint8_t>*) data;
+        stream->insert(stream->end(), buffer, buffer + bytes);
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    auto encoder = FLAC__stream_encoder_new();
+    FLAC__stream_encoder_set_compression_level(encoder, level);
+    FLAC__stream_encoder_set_channels(encoder, 2);
+    FLAC__stream_encoder_set_bits_per_sample(encoder, 16);
+    FLAC__stream_encoder_set_sample_rate(encoder, 44100);
+    FLAC__stream_encoder_set_streamable_subset(encoder, true);
+    FLAC__stream_encoder_init_stream(encoder, write, NULL, NULL, NULL, &stream);
+
+    std::vector<FLAC__int32> wide(8192);
+    for (size_t at = 0; at < pcm.size(); at += wide.size()) {
+        size_t count = std::min(wide.size(), pcm.size() - at);
+        for (size_t i = 0; i < count; i++) wide[i] = pcm[at + i];
+        FLAC__stream_encoder_process_interleaved(encoder, wide.data(), count / 2);
+    }
+
+    FLAC__stream_encoder_finish(encoder);
+    FLAC__stream_encoder_delete(encoder);
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stream;
+}
+
+static std::vector<uint8_t> segmented(const std::vector<int16_t>& pcm, int level, double& seconds) {
+    std::vector<uint8_t> stream, buffer(64 * 1024);
+    codecSettings settings;
+    settings.flac.level = level;
+
+    auto start = std::chrono::steady_clock::now();
+    auto codec = createCodec(codecSettings::FLAC, settings);
+    codec->initialize(pcm.size() * 1000 / (2 * 44100));
+
+    auto drain = [&](bool last) {
+        size_t n = codec->read(buffer.data(), buffer.size(), 0, last);
+        stream.insert(stream.end(), buffer.data(), buffer.data() + n);
+        return n;
+    };
+
+    auto data = (const uint8_t*) pcm.data();
+    for (size_t at = 0, size = pcm.size() * 2; at < size; ) {
+        size_t chunk = std::min((size_t) 16384, size - at);
+        if (codec->pcmWrite(data + at, chunk)) at += chunk;
+        else if (!drain(false)) std::this_thread::yield();
+    }
+
+    // encoder has all it will get, wait for what it still has
+    while (!codec->isDrained() || drain(true)) std::this_thread::yield();
+
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stream;
+}
+
+int main(void) {
+    bell::setDefaultLogger();
+    encodePool::count = std::max(std::thread::hardware_concurrency(), 2u);
+
+    // 20 s of tones with a moving level, noise, a silent part and an odd length at the end
+    std::vector<int16_t> pcm(2 * (20 * 44100 + 1234));
+    std::mt19937 random(42);
+    std::normal_distribution<double> noise(0, 300);
+    for (size_t i = 0; i < pcm.size() / 2; i++) {
+        double t = i / 44100.0, level = t > 8 && t < 9 ? 0 : 0.4 + 0.3 * sin(t);
+        double left = level * (sin(2 * M_PI * 440 * t) + 0.5 * sin(2 * M_PI * (200 + 50 * t) * t)) * 16000 + noise(random);
+        double right = level * sin(2 * M_PI * 660 * t + 0.3) * 20000 + noise(random);
+        pcm[2 * i] = (int16_t) std::clamp(left, -32768.0, 32767.0);
+        pcm[2 * i + 1] = (int16_t) std::clamp(right, -32768.0, 32767.0);
+    }
+
+    int failures = 0;
+    double audio = pcm.size() / 2 / 44100.0;
+    printf("%u workers, %.1f s of audio\n", encodePool::size(), audio);
+    printf("level  reference (x realtime, bytes)  segmented (x realtime, bytes)  identical\n");
+
+    for (int level = 0; level <= 8; level++) {
+        double refTime, segTime;
+        auto ref = reference(pcm, level, refTime);
+        auto seg = segmented(pcm, level, segTime);
+        auto refDecoded = decode(ref), segDecoded = decode(seg);
+
+        bool ok = segDecoded.errors == 0 && segDecoded.sequence && segDecoded.samples == pcm &&
+                  refDecoded.errors == 0 && refDecoded.samples == pcm;
+        printf("%5d  %9.0f %12zu  %15.0f %12zu  %9s %s\n", level, audio / refTime, ref.size(), audio / segTime, seg.size(),
+               ref == seg ? "yes" : "no", ok ? "" : "FAIL");
+        if (!ok) {
+            printf("       frames:%" PRIu64 " errors:%u sequence:%d samples:%zu/%zu\n", segDecoded.frames, segDecoded.errors,
+                   segDecoded.sequence, segDecoded.samples.size(), pcm.size());
+            failures++;
+        }
+    }
+
+    encodePool::stop();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,248 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "Logger.h"
+#include "codecs.h"
+#include "ogg/ogg.h"
+#include "vorbis/codec.h"
+
+/****************************************************************************************
+ * Ogg Vorbis relayed as-is. Source is what vorbis codec makes (as Spotify's, pages of one
+ * logical stream), fed from the start, from the middle of the track as after a seek (no
+ * headers then) and twice in a row as two tracks in flow mode. What comes out must be
+ * valid pages (libogg checks CRCs), one serial per chain numbered from 0, flagged BOS/EOS,
+ * granules starting at 0 and it must decode without any hole
+ */
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok) failures++;
+}
+
+static std::vector<uint8_t> run(baseCodec& codec, const uint8_t* data, size_t size, size_t chunk) {
+    std::vector<uint8_t> stream, buffer(64 * 1024);
+
+    auto drain = [&](bool last) {
+        size_t n = codec.read(buffer.data(), buffer.size(), 0, last);
+        stream.insert(stream.end(), buffer.data(), buffer.data() + n);
+        return n;
+    };
+
+    for (size_t at = 0; at < size;) {
+        size_t len = std::min(chunk, size - at);
+        if (codec.pcmWrite(data + at, len)) at += len;
+        else if (!drain(false)) std::this_thread::yield();
+    }
+
+    while (!codec.isDrained() || drain(true)) std::this_thread::yield();
+    return stream;
+}
+
+struct chain {
+    uint32_t serial;
+    uint32_t pages = 0;
+    bool sequence = true, bos = true, eos = false;
+    int64_t firstGranule = -1, lastGranule = -1;
+};
+
+static std::vector<chain> parse(const std::vector<uint8_t>& stream, unsigned& invalid) {
+    std::vector<chain> chains;
+    ogg_sync_state sync;
+    ogg_page page;
+    ogg_sync_init(&sync);
+    memcpy(ogg_sync_buffer(&sync, stream.size()), stream.data(), stream.size());
+    ogg_sync_wrote(&sync, stream.size());
+    invalid = 0;
+
+    for (int result; (result = ogg_sync_pageout(&sync, &page)) != 0;) {
+        // a bad checksum is reported as a hole
+        if (result < 0) {
+            invalid++;
+            continue;
+        }
+        if (ogg_page_bos(&page)) chains.push_back({ (uint32_t) ogg_page_serialno(&page) });
+        if (chains.empty()) {
+            invalid++;
+            continue;
+        }
+        auto& chain = chains.back();
+        int64_t granule = ogg_page_granulepos(&page);
+        chain.sequence &= ogg_page_pageno(&page) == chain.pages && (uint32_t) ogg_page_serialno(&page) == chain.serial;
+        chain.bos &= chain.pages == 0 || !ogg_page_bos(&page);
+        if (chain.eos) chain.sequence = false;
+        chain.eos = ogg_page_eos(&page);
+        if (granule > 0 && chain.firstGranule < 0) chain.firstGranule = granule;
+        if (granule >= 0) chain.lastGranule = std::max(chain.lastGranule, granule);
+        chain.pages++;
+    }
+
+    ogg_sync_clear(&sync);
+    return chains;
+}
+
+// samples decoded (not trimmed to last granule) and holes, per chain
+static int64_t decode(const std::vector<uint8_t>& stream, unsigned& holes) {
+    ogg_sync_state sync;
+    ogg_stream_state in;
+    ogg_page page;
+    ogg_packet packet;
+    vorbis_info info;
+    vorbis_comment comment;
+    vorbis_dsp_state dsp;
+    vorbis_block block;
+    int headers = 0;
+    int64_t samples = 0;
+    holes = 0;
+
+    ogg_sync_init(&sync);
+    ogg_stream_init(&in, 0);
+    memcpy(ogg_sync_buffer(&sync, stream.size()), stream.data(), stream.size());
+    ogg_sync_wrote(&sync, stream.size());
+
+    while (ogg_sync_pageout(&sync, &page) > 0) {
+        if (ogg_page_bos(&page)) {
+            if (headers == 3) {
+                vorbis_block_clear(&block);
+                vorbis_dsp_clear(&dsp);
+            }
+            if (headers) {
+                vorbis_comment_clear(&comment);
+                vorbis_info_clear(&info);
+            }
+            ogg_stream_reset_serialno(&in, ogg_page_serialno(&page));
+            vorbis_info_init(&info);
+            vorbis_comment_init(&comment);
+            headers = 0;
+        }
+
+        ogg_stream_pagein(&in, &page);
+        for (int result; (result = ogg_stream_packetout(&in, &packet)) != 0;) {
+            if (result < 0) {
+                holes++;
+                continue;
+            }
+            if (headers < 3) {
+                if (vorbis_synthesis_headerin(&info, &comment, &packet)) holes++;
+                else if (++headers == 3) {
+                    vorbis_synthesis_init(&dsp, &info);
+                    vorbis_block_init(&dsp, &block);
+                }
+                continue;
+            }
+            if (vorbis_synthesis(&block, &packet) == 0) vorbis_synthesis_blockin(&dsp, &block);
+            float** pcm;
+            for (int n; (n = vorbis_synthesis_pcmout(&dsp, &pcm)) > 0;) {
+                samples += n;
+                vorbis_synthesis_read(&dsp, n);
+            }
+        }
+    }
+
+    if (headers == 3) {
+        vorbis_block_clear(&block);
+        vorbis_dsp_clear(&dsp);
+    }
+    if (headers) {
+        vorbis_comment_clear(&comment);
+        vorbis_info_clear(&info);
+    }
+    ogg_stream_clear(&in);
+    ogg_sync_clear(&sync);
+    return samples;
+}
+
+// where a page starts after that position, for a source that is a single chain
+static size_t pageAfter(const std::vector<uint8_t>& stream, size_t from) {
+    for (size_t i = from; i + 4 < stream.size(); i++) {
+        if (!memcmp(stream.data() + i, "OggS", 4)) return i;
+    }
+    return stream.size();
+}
+
+int main(void) {
+    bell::setDefaultLogger();
+    encodePool::count = 2;
+    codecSettings settings;
+    settings.vorbis.bitrate = 160;
+
+    // 12 s of two tones
+    std::vector<int16_t> pcm(2 * 12 * 44100);
+    for (size_t i = 0; i < pcm.size() / 2; i++) {
+        double t = i / 44100.0;
+        pcm[2 * i] = (int16_t) (sin(2 * M_PI * 440 * t) * 12000);
+        pcm[2 * i + 1] = (int16_t) (sin(2 * M_PI * 554 * t) * 12000);
+    }
+
+    auto vorbis = createCodec(codecSettings::VORBIS, settings);
+    vorbis->initialize(12 * 1000);
+    auto source = run(*vorbis, (const uint8_t*) pcm.data(), pcm.size() * 2, 16384);
+    unsigned invalid, holes;
+    auto sourceChains = parse(source, invalid);
+    check(sourceChains.size() == 1 && !invalid, "source is one valid chain");
+    int64_t total = sourceChains.empty() ? 0 : sourceChains[0].lastGranule;
+    int64_t decoded = decode(source, holes);
+
+    // whole track, fed with sizes that never match pages
+    {
+        auto ogg = createCodec(codecSettings::OGG, settings);
+        ogg->setIndex(std::make_shared<seekIndex>());
+        ogg->initialize(12 * 1000);
+        auto out = run(*ogg, source.data(), source.size(), 1000);
+        auto chains = parse(out, invalid);
+        bool ok = chains.size() == 1 && !invalid && chains[0].sequence && chains[0].bos && chains[0].eos &&
+                  chains[0].serial != sourceChains[0].serial && chains[0].lastGranule == total;
+        check(ok, "whole track is relayed as one clean chain with the same granules");
+        check(out.size() == source.size(), "whole track has the same size");
+        int64_t samples = decode(out, holes);
+        check(samples == decoded && !holes, "whole track decodes to every sample");
+    }
+
+    // from the middle without headers, after what was before has been flushed
+    {
+        auto ogg = createCodec(codecSettings::OGG, settings);
+        ogg->setIndex(std::make_shared<seekIndex>());
+        ogg->initialize(12 * 1000);
+        size_t half = pageAfter(source, source.size() / 2);
+        run(*ogg, source.data(), half / 2, 4096);
+        ogg->flush();
+        ogg->initialize(6 * 1000);
+        auto out = run(*ogg, source.data() + half, source.size() - half, 4096);
+        auto chains = parse(out, invalid);
+        bool ok = chains.size() == 1 && !invalid && chains[0].sequence && chains[0].bos && chains[0].eos &&
+                  chains[0].lastGranule < total * 6 / 10 && chains[0].lastGranule > total * 4 / 10;
+        check(ok, "seek restarts a chain with headers and granules rebased");
+        int64_t samples = decode(out, holes);
+        check(samples > 0 && !holes && std::abs(samples - chains[0].lastGranule) <= 2048, "seek decodes from its start");
+    }
+
+    // two tracks in a row, second is chained
+    {
+        auto ogg = createCodec(codecSettings::OGG, settings);
+        ogg->setIndex(std::make_shared<seekIndex>());
+        ogg->initialize(24 * 1000);
+        std::vector<uint8_t> twice(source);
+        twice.insert(twice.end(), source.begin(), source.end());
+        auto out = run(*ogg, twice.data(), twice.size(), 3000);
+        auto chains = parse(out, invalid);
+        bool ok = chains.size() == 2 && !invalid && chains[0].serial != chains[1].serial;
+        for (auto& chain : chains) ok &= chain.sequence && chain.bos && chain.eos && chain.lastGranule == total;
+        check(ok, "track change starts a new chain, previous one is ended");
+        int64_t samples = decode(out, holes);
+        check(samples == 2 * decoded && !holes, "chained tracks decode to every sample");
+    }
+
+    encodePool::stop();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,210 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <chrono>
+
+#include "HTTPstreamer.h"
+
+/****************************************************************************************
+ * Replays requests as Sonos, WiiM and Denon (HEOS) renderers send them, split the way they
+ * arrive from the network, through requestParser and responseWriter, i.e. what connect()
+ * does with a request before looking at cache. Same is done with std::regex, a map and a
+ * stringstream, which is how it was done before. Both must find the same values
+ */
+
+static const char* requests[] = {
+    // Sonos, initial request then range request after pause
+    "GET /stream?id=7c2a91f0 HTTP/1.1\r\n"
+    "CONNECTION: close\r\n"
+    "ACCEPT-ENCODING: gzip\r\n"
+    "HOST: 192.168.1.20:49152\r\n"
+    "USER-AGENT: Linux UPnP/1.0 Sonos/79.1-56030 (ZPS27)\r\n"
+    "Icy-MetaData: 1\r\n"
+    "\r\n",
+    "GET /stream?id=7c2a91f0 HTTP/1.1\r\n"
+    "CONNECTION: close\r\n"
+    "Range: bytes=1572864-\r\n"
+    "ACCEPT-ENCODING: gzip\r\n"
+    "HOST: 192.168.1.20:49152\r\n"
+    "USER-AGENT: Linux UPnP/1.0 Sonos/79.1-56030 (ZPS27)\r\n"
+    "\r\n",
+    // WiiM, HEAD probe then GET with DLNA headers
+    "HEAD /stream?id=7c2a91f0 HTTP/1.1\r\n"
+    "Host: 192.168.1.20:49152\r\n"
+    "User-Agent: Lavf/58.76.100\r\n"
+    "Accept: */*\r\n"
+    "Icy-MetaData: 1\r\n"
+    "\r\n",
+    "GET /stream?id=7c2a91f0 HTTP/1.1\r\n"
+    "Host: 192.168.1.20:49152\r\n"
+    "User-Agent: Lavf/58.76.100\r\n"
+    "Accept: */*\r\n"
+    "Range: bytes=0-\r\n"
+    "Connection: keep-alive\r\n"
+    "transferMode.dlna.org: Streaming\r\n"
+    "getcontentFeatures.dlna.org: 1\r\n"
+    "\r\n",
+    // Denon, time-seek
+    "GET /stream?id=7c2a91f0 HTTP/1.1\r\n"
+    "Host: 192.168.1.20:49152\r\n"
+    "User-Agent: Denon-Heos/149200\r\n"
+    "Accept: */*\r\n"
+    "TimeSeekRange.dlna.org: npt=83.500-\r\n"
+    "getAvailableSeekRange.dlna.org: 1\r\n"
+    "transferMode.dlna.org: Streaming\r\n"
+    "Connection: close\r\n"
+    "\r\n",
+};
+
+// parser gives views in what it has received, before it was strings in a map
+template <typename T> struct result {
+    T userAgent, range, connection, icy, npt;
+    bool head = false, http11 = false;
+    size_t size = 0;
+};
+
+static void respond(const result<std::string_view>& r, responseWriter& head) {
+    head.clear();
+    head.add("%s %s\r\n", r.http11 ? "HTTP/1.1" : "HTTP/1.0", r.range.empty() ? "200 OK" : "206 Partial Content");
+    if (!r.head) head.add("Content-Length: %" PRId64 "\r\n", (int64_t) 41238476);
+    head.add("contentFeatures.dlna.org: %s\r\n", "DLNA.ORG_OP=01;DLNA.ORG_CI=1;DLNA.ORG_FLAGS=01700000000000000000000000000000");
+    head.add("Server: spot-connect\r\n");
+    head.add("Accept-Ranges: bytes\r\n");
+    head.add("Content-Type: %s\r\n", "audio/flac");
+    head.add(requestParser::equals(r.connection, "close") ? "Connection: close\r\n\r\n" : "Connection: keep-alive\r\n\r\n");
+}
+
+// views are valid until caller consumes request
+static result<std::string_view> parseNow(requestParser& rx, responseWriter& head, const char* request) {
+    // a request most often arrives in 2 segments
+    size_t len = strlen(request), split = len / 3;
+    rx.append(request, split);
+    (void) rx.complete();
+    rx.append(request + split, len - split);
+
+    result<std::string_view> r;
+    if (!rx.complete() || !rx.parse()) return r;
+    auto header = [&rx](const char* name) { auto value = rx.header(name); return value.data() ? value : ""; };
+
+    r.head = rx.method == "HEAD";
+    r.http11 = rx.version == "HTTP/1.1";
+    r.userAgent = header("user-agent");
+    r.range = header("range");
+    r.connection = header("connection");
+    r.icy = header("icy-metadata");
+    r.npt = header("timeseekrange.dlna.org");
+
+    respond(r, head);
+    r.size = head.size;
+    return r;
+}
+
+static result<std::string> parseBefore(const char* request) {
+    // what connect() used to do: vector copy, line splitting, regex trimming and a map
+    std::string received;
+    size_t len = strlen(request), split = len / 3;
+    received.append(request, split);
+    (void) received.find("\r\n\r\n");
+    received.append(request + split, len - split);
+
+    size_t end = received.find("\r\n\r\n") + 4;
+    auto data = std::vector<uint8_t>(received.begin(), received.begin() + end);
+    std::regex expr("^\\s+|\\s+$");
+    std::map<std::string, std::string> headers;
+    size_t offset = 0;
+
+    auto nextLine = [&data, &offset](void) {
+        uint8_t* start, * end;
+        std::string line;
+        for (end = start = data.data() + offset; offset < data.size() && *end != '\r' && *end != '\n'; end++, offset++);
+        if (offset < data.size()) {
+            line = std::string(start, end);
+            for (; (*end == '\r' || *end == '\n') && offset < data.size(); end++, offset++);
+        }
+        return line;
+    };
+
+    auto line = nextLine();
+    for (auto header = nextLine(); !header.empty(); header = nextLine()) {
+        size_t pos = header.find(':');
+        if (pos == std::string::npos) continue;
+        for (auto& c : header) c = tolower(c);
+        headers[std::regex_replace(header.substr(0, pos), expr, "")] = std::regex_replace(header.substr(pos + 1), expr, "");
+    }
+
+    result<std::string> r;
+    r.head = line.find("HEAD") != std::string::npos;
+    r.http11 = line.find("HTTP/1.1") != std::string::npos;
+    r.userAgent = headers["user-agent"];
+    r.range = headers["range"];
+    r.connection = headers["connection"];
+    r.icy = headers["icy-metadata"];
+    r.npt = headers["timeseekrange.dlna.org"];
+
+    std::stringstream response;
+    response << (r.http11 ? "HTTP/1.1 " : "HTTP/1.0 ") + std::string(r.range.empty() ? "200 OK" : "206 Partial Content") + "\r\n";
+    if (!r.head) response << "Content-Length: " + std::to_string(41238476) + "\r\n";
+    response << "contentFeatures.dlna.org: DLNA.ORG_OP=01;DLNA.ORG_CI=1;DLNA.ORG_FLAGS=01700000000000000000000000000000\r\n";
+    response << "Server: spot-connect\r\n";
+    response << "Accept-Ranges: bytes\r\n";
+    response << "Content-Type: " + std::string("audio/flac") + "\r\n";
+    response << (r.connection == "close" ? "Connection: close\r\n" : "Connection: keep-alive\r\n");
+    response << "\r\n";
+    r.size = response.str().size();
+    return r;
+}
+
+template <typename F> static double measure(size_t rounds, F f) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; i++) {
+        for (auto request : requests) f(request);
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return elapsed / (rounds * std::size(requests));
+}
+
+int main(int argc, char* argv[]) {
+    size_t rounds = argc > 1 ? atoi(argv[1]) : 100000;
+    auto rx = std::make_unique<requestParser>();
+    responseWriter head;
+    bool valid = true;
+
+    // values used to be lower-cased along with names
+    for (auto request : requests) {
+        auto now = parseNow(*rx, head, request);
+        auto before = parseBefore(request);
+        bool same = requestParser::equals(now.userAgent, before.userAgent) && requestParser::equals(now.range, before.range) &&
+                    requestParser::equals(now.connection, before.connection) && requestParser::equals(now.icy, before.icy) &&
+                    requestParser::equals(now.npt, before.npt) && now.head == before.head && now.http11 == before.http11 &&
+                    now.size == before.size;
+        rx->consume();
+        if (!same) {
+            printf("mismatch for\n%s", request);
+            valid = false;
+        }
+    }
+
+    size_t sink = 0;
+    double now = measure(rounds, [&](const char* request) {
+        sink += parseNow(*rx, head, request).size;
+        rx->consume();
+    });
+    double before = measure(rounds / 20 + 1, [&](const char* request) { sink += parseBefore(request).size; });
+
+    printf("requestParser/responseWriter %8.0f ns/request\n", now);
+    printf("regex/map/stringstream       %8.0f ns/request (x%.1f)\n", before, before / now);
+    return valid && sink ? 0 : 1;
+}
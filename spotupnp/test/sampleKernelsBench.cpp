@@ -0,0 +1,51 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <cstdio>
+#include <vector>
+#include <chrono>
+
+#include "sampleKernels.h"
+
+/****************************************************************************************
+ * Throughput of each implementation, on one codec-sized buffer (4096 frames) processed
+ * over and over so that it stays in cache, like codecs do
+ */
+
+template <typename F> static double measure(F f, size_t bytes) {
+    // warm-up, then run for about 200 ms
+    for (int i = 0; i < 100; i++) f();
+    size_t runs = 0;
+    auto start = std::chrono::steady_clock::now(), now = start;
+    for (; now - start < std::chrono::milliseconds(200); now = std::chrono::steady_clock::now()) {
+        for (int i = 0; i < 100; i++) f();
+        runs += 100;
+    }
+    return runs * bytes / std::chrono::duration<double>(now - start).count() / (1024 * 1024);
+}
+
+int main(void) {
+    const size_t frames = 4096;
+    std::vector<int16_t> src(2 * frames + 1);
+    std::vector<int32_t> wide(2 * frames + 1);
+    std::vector<float> left(frames), right(frames);
+    std::vector<uint16_t> swap(2 * frames + 1);
+
+    for (size_t i = 0; i < src.size(); i++) src[i] = (int16_t) (i * 2654435761u);
+
+    printf("%-6s %12s %12s %12s (MB/s of 16 bits input)\n", "", "widen", "deinterleave", "byteswap");
+    for (auto& set : sampleKernels::available()) {
+        double widen = measure([&] { set.widen(src.data(), wide.data(), 2 * frames); }, 4 * frames);
+        double deinterleave = measure([&] { set.deinterleave(src.data(), left.data(), right.data(), frames); }, 4 * frames);
+        double byteswap = measure([&] { set.byteswap(swap.data(), 2 * frames); }, 4 * frames);
+        printf("%-6s %12.0f %12.0f %12.0f\n", set.name, widen, deinterleave, byteswap);
+        // unaligned buffers should not cost much
+        double unaligned = measure([&] { set.widen(src.data() + 1, wide.data() + 1, 2 * frames); }, 4 * frames);
+        printf("%-6s %12.0f %12s %12s (unaligned)\n", set.name, unaligned, "", "");
+    }
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <random>
+
+#include "sampleKernels.h"
+
+/****************************************************************************************
+ * Every implementation must give exactly what plain C gives, whatever the length (so that
+ * vector tails are exercised) and whatever the alignment of buffers
+ */
+
+static int failures = 0;
+
+static void check(bool ok, const char* kernel, const char* name, size_t count, size_t shift) {
+    if (ok) return;
+    printf("FAIL %s %s count:%zu shift:%zu\n", kernel, name, count, shift);
+    failures++;
+}
+
+int main(void) {
+    auto sets = sampleKernels::available();
+    auto& reference = sets.front();
+    std::mt19937 random(1234);
+
+    // a few extreme values first, then random ones
+    std::vector<int16_t> samples(2 * 1024 + 8);
+    for (auto& sample : samples) sample = (int16_t) random();
+    samples[0] = INT16_MIN;
+    samples[1] = INT16_MAX;
+    samples[2] = -1;
+    samples[3] = 0;
+
+    for (auto& set : sets) {
+        printf("testing %s\n", set.name);
+
+        for (size_t count = 0; count <= 67; count += count < 40 ? 1 : 9) {
+            // shifts move buffers off the alignment of any vector size
+            for (size_t shift = 0; shift < 4; shift++) {
+                const int16_t* src = samples.data() + shift;
+
+                std::vector<int32_t> wideRef(count + 4), wide(count + 4);
+                reference.widen(src, wideRef.data() + shift, count);
+                set.widen(src, wide.data() + shift, count);
+                check(wideRef == wide, set.name, "widen", count, shift);
+
+                std::vector<float> leftRef(count + 4), rightRef(count + 4), left(count + 4), right(count + 4);
+                reference.deinterleave(src, leftRef.data() + shift, rightRef.data() + shift, count);
+                set.deinterleave(src, left.data() + shift, right.data() + shift, count);
+                check(!memcmp(leftRef.data(), left.data(), left.size() * sizeof(float)) &&
+                      !memcmp(rightRef.data(), right.data(), right.size() * sizeof(float)), set.name, "deinterleave", count, shift);
+
+                std::vector<uint16_t> swapRef(samples.begin(), samples.begin() + count + 4), swap = swapRef;
+                reference.byteswap(swapRef.data() + shift, count);
+                set.byteswap(swap.data() + shift, count);
+                check(swapRef == swap, set.name, "byteswap", count, shift);
+            }
+        }
+    }
+
+    // reference itself must be right
+    int16_t pair[2] = { 0x1234, INT16_MIN };
+    uint16_t swapped = 0x1234;
+    int32_t wide[2];
+    float left, right;
+    reference.widen(pair, wide, 2);
+    reference.deinterleave(pair, &left, &right, 1);
+    reference.byteswap(&swapped, 1);
+    check(wide[0] == 0x1234 && wide[1] == INT16_MIN && swapped == 0x3412 && left == 0x1234 / (float) INT16_MAX &&
+          right < -1.0f, reference.name, "reference", 2, 0);
+
+    printf("%s (%zu implementations, %s picked)\n", failures ? "FAILED" : "passed", sets.size(), sampleKernels::name);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+
+#include "HTTPstreamer.h"
+
+/****************************************************************************************
+ * Streams over loopback the way a streamer does, through the reactor and a send queue,
+ * from memory (sendmsg), from disk cache (sendfile, headers with MSG_MORE) or through
+ * io_uring (zero-copy from a registered buffer when kernel has it). Body is chunked with
+ * 16 kB chunks from memory and 1 MB regions from file, like streamBody(). It reports
+ * throughput and the CPU used by sending side (process minus receiver) per Mbit
+ */
+
+enum mode { MEMORY, FILE_REGION, URING };
+static const char* names[] = { "sendmsg", "sendfile", "io_uring" };
+
+class sender : public reactorHandler {
+private:
+    HTTPreactor* reactor;
+    sendQueue tx;
+    const uint8_t* data;
+    size_t size, chunk, offset = 0;
+    uint64_t left;
+    int fd, sock;
+    char header[16];
+
+    void pump(void) {
+        while (true) {
+            if (!tx.empty()) {
+                if (tx.busy) return;
+                if (reactor->async() && tx.submit(reactor, this, sock)) return;
+                if (tx.send(sock) < 0) {
+                    perror("send");
+                    exit(1);
+                }
+                if (!tx.empty()) {
+                    reactor->watch(sock, this, READ | WRITE);
+                    return;
+                }
+            }
+
+            if (!left) {
+                reactor->unwatch(sock);
+                shutdown(sock, SHUT_WR);
+                return;
+            }
+
+            size_t len = std::min({ chunk, size - offset, (size_t) left });
+            tx.copy(header, snprintf(header, sizeof(header), "%zx\r\n", len));
+            if (fd >= 0) tx.pushFile(fd, offset, len);
+            else tx.push(data + offset, len);
+            tx.push("\r\n", 2);
+            offset = (offset + len) % size;
+            left -= len;
+        }
+    }
+
+public:
+    sender(HTTPreactor* reactor, int sock, const uint8_t* data, size_t size, int fd, size_t chunk, uint64_t total)
+        : reactor(reactor), data(data), size(size), chunk(chunk), left(total), fd(fd), sock(sock) {
+        reactor->attach(this);
+        reactor->watch(sock, this, READ | WRITE);
+    }
+    ~sender(void) { reactor->detach(this); }
+    void onEvent(int sock, int events) { pump(); }
+    void onSent(int sock, ssize_t result) {
+        if (result < 0) {
+            fprintf(stderr, "async send failed %zd\n", result);
+            exit(1);
+        }
+        tx.sent(result);
+        pump();
+    }
+};
+
+static double processCpu(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static double threadCpu(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool run(mode mode, const std::vector<uint8_t>& data, int fd, uint64_t total) {
+    int listenSock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { };
+    socklen_t len = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listenSock, (struct sockaddr*) &addr, len);
+    getsockname(listenSock, (struct sockaddr*) &addr, &len);
+    listen(listenSock, 1);
+
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    connect(client, (struct sockaddr*) &addr, len);
+    int sock = accept(listenSock, NULL, NULL);
+    close(listenSock);
+    setNonBlocking(sock);
+
+    // each mode gets its own reactor, as io_uring is decided when it is created
+    HTTPreactor::useUring = mode == URING;
+    auto reactor = std::make_unique<HTTPreactor>();
+    reactor->startTask();
+    int buffer = mode == URING ? reactor->registerBuffer(data.data(), data.size()) : -1;
+
+    // receiver checks nothing but size, its CPU is measured to be taken out
+    uint64_t received = 0;
+    double receiverCpu = 0;
+    std::thread receiver([&] {
+        std::vector<char> buffer(256 * 1024);
+        double start = threadCpu();
+        for (ssize_t n; (n = recv(client, buffer.data(), buffer.size(), 0)) > 0;) received += n;
+        receiverCpu = threadCpu() - start;
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    double cpu = processCpu();
+    {
+        sender sender(reactor.get(), sock, data.data(), data.size(), mode == FILE_REGION ? fd : -1,
+                      mode == FILE_REGION ? 1024 * 1024 : 16384, total);
+        receiver.join();
+    }
+    cpu = processCpu() - cpu - receiverCpu;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    reactor->unregisterBuffer(buffer);
+    reactor.reset();
+    close(sock);
+    close(client);
+
+    // body is data plus chunk framing, what matters is payload
+    double mbits = total * 8 / 1e6;
+    bool valid = received > total;
+    printf("%-10s %9.0f Mbit/s  sender CPU %5.1f%%  %7.2f us CPU/Mbit%s%s\n", names[mode], mbits / elapsed,
+           cpu * 100 / elapsed, cpu * 1e6 / mbits, mode == URING && buffer >= 0 ? " (registered buffer)" : "",
+           valid ? "" : " INCOMPLETE");
+    return valid;
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t total = (argc > 1 ? atoll(argv[1]) : 1024) * 1024 * 1024;
+    std::vector<uint8_t> data(4 * 1024 * 1024);
+    for (size_t i = 0; i < data.size(); i++) data[i] = i * 2654435761u >> 24;
+
+    // same content on disk, as a fileBuffer would have it (page cache is warm)
+    char name[] = "/tmp/sendBenchXXXXXX";
+    int fd = mkstemp(name);
+    if (fd < 0 || write(fd, data.data(), data.size()) != (ssize_t) data.size()) {
+        perror("can't create data file");
+        return 1;
+    }
+    unlink(name);
+
+    printf("streaming %" PRIu64 " MB over loopback\n", total >> 20);
+    bool valid = true;
+    for (auto mode : { MEMORY, FILE_REGION, URING }) valid &= run(mode, data, fd, total);
+
+    close(fd);
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+
+#include "HTTPstreamer.h"
+
+/****************************************************************************************
+ * Track cache on disk. A track being written must survive eviction even when others have
+ * been used (and moved in front) while it was being written
+ */
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok) failures++;
+}
+
+static std::shared_ptr<trackCache::entry> makeTrack(uint8_t fill) {
+    auto track = std::make_shared<trackCache::entry>();
+    track->data.assign(1024 * 1024, fill);
+    return track;
+}
+
+// same naming as the cache, so that we can tell when a writer is done
+static std::filesystem::path fileName(const std::filesystem::path& dir, const std::string& id) {
+    std::string key = id + "@0";
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (auto c : key) hash = (hash ^ (uint8_t) c) * 0x100000001b3ULL;
+
+    char name[24];
+    snprintf(name, sizeof(name), "%016" PRIx64 ".trk", hash);
+    return dir / name;
+}
+
+static bool waitFile(const std::filesystem::path& name) {
+    for (int i = 0; i < 500 && !std::filesystem::exists(name); i++) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return std::filesystem::exists(name);
+}
+
+int main(void) {
+    auto dir = std::filesystem::temp_directory_path() / "spotupnp-trackCacheTest";
+    std::filesystem::remove_all(dir);
+    const size_t size = 1024 * 1024;
+
+    // nothing in memory so that all gets go through files, disk holds 2 tracks (and a bit)
+    trackCache::capacity = 0;
+    trackCache::open(dir.string(), 2 * size + size / 2 + 1024);
+
+    std::vector<std::string> names = { "A", "B" };
+    for (auto& name : names) {
+        trackCache::put(name, 0, makeTrack(name[0]));
+        waitFile(fileName(dir, name));
+    }
+    check(trackCache::get("A", 0) && trackCache::get("B", 0), "A and B stored");
+
+    // each C is written while all others are used so it's at the back when it's done
+    for (int round = 0; round < 10; round++) {
+        auto name = std::string("C") + std::to_string(round);
+        trackCache::put(name, 0, makeTrack('C'));
+        for (auto& other : names) trackCache::get(other, 0);
+        names.push_back(name);
+
+        bool stored = waitFile(fileName(dir, name));
+        auto track = trackCache::get(name, 0);
+        check(stored && track && track->data.size() == size && track->data[0] == 'C', ("written track survives eviction " + name).c_str());
+    }
+
+    // disk capacity is respected
+    trackCache::close();
+    size_t total = 0, count = 0;
+    for (auto& item : std::filesystem::directory_iterator(dir)) {
+        if (item.path().extension() == ".trk") total += item.file_size(), count++;
+    }
+    check(count == 2 && total < 2 * size + size / 2 + 1024, "only what fits is kept");
+
+    std::filesystem::remove_all(dir);
+    return failures ? 1 : 0;
+}
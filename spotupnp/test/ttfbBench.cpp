@@ -0,0 +1,131 @@
+/*
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "HTTPmode.h"
+#include "HTTPstreamer.h"
+
+/****************************************************************************************
+ * Time to first byte. A player requests a stream over loopback and PCM only starts to
+ * arrive some time later (as when cspot is still fetching the track), then at real-time
+ * pace. What matters is how long after PCM arrival the first byte of body is received,
+ * which used to depend on when the streamer's polling tick happened to come
+ */
+
+using namespace std::chrono;
+
+static double ms(steady_clock::duration d) { return duration<double, std::milli>(d).count(); }
+
+static bool run(unsigned index, const char* codec, milliseconds delay, double& fromRequest, double& fromPcm) {
+    struct in_addr addr;
+    inet_aton("127.0.0.1", &addr);
+
+    // no track id, so that track cache is never used
+    auto streamer = std::make_shared<HTTPstreamer>(addr, "ttfb", index, codec, false, HTTP_CACHE_MEM, nullptr, nullptr);
+    cspot::TrackInfo track;
+    track.duration = 10 * 1000;
+    streamer->assign(track, "", 0, HTTP_CL_NONE);
+    streamer->start();
+
+    // url is http://host:port/path
+    auto url = streamer->getStreamUrl();
+    auto hostEnd = url.find(':', 7), pathStart = url.find('/', hostEnd);
+    struct sockaddr_in server = { };
+    server.sin_family = AF_INET;
+    server.sin_addr = addr;
+    server.sin_port = htons(atoi(url.c_str() + hostEnd + 1));
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(sock, (struct sockaddr*) &server, sizeof(server)) < 0) {
+        perror("can't connect");
+        return false;
+    }
+
+    auto request = "GET " + url.substr(pathStart) + " HTTP/1.1\r\nHost: " + url.substr(7, pathStart - 7) + "\r\nConnection: close\r\n\r\n";
+    auto requestTime = steady_clock::now();
+    (void) !send(sock, request.data(), request.size(), 0);
+
+    // PCM comes late, then 4 kB every 23 ms (about real-time)
+    std::atomic<bool> stop = false;
+    steady_clock::time_point pcmTime;
+    std::thread feeder([&] {
+        std::vector<uint8_t> pcm(4096);
+        for (size_t i = 0; i < pcm.size(); i++) pcm[i] = i * 7;
+        std::this_thread::sleep_for(delay);
+        pcmTime = steady_clock::now();
+        while (!stop) {
+            streamer->feedPCMFrames(pcm.data(), pcm.size());
+            std::this_thread::sleep_for(milliseconds(23));
+        }
+    });
+
+    // headers come first, body is what follows the empty line
+    std::string received;
+    char buffer[4096];
+    steady_clock::time_point firstByte;
+    for (ssize_t n; (n = recv(sock, buffer, sizeof(buffer), 0)) > 0;) {
+        received.append(buffer, n);
+        auto end = received.find("\r\n\r\n");
+        if (end != std::string::npos && received.size() > end + 4) {
+            firstByte = steady_clock::now();
+            break;
+        }
+    }
+
+    stop = true;
+    feeder.join();
+    close(sock);
+    streamer.reset();
+
+    if (firstByte == steady_clock::time_point()) {
+        printf("no body received\n");
+        return false;
+    }
+
+    fromRequest = ms(firstByte - requestTime);
+    fromPcm = ms(firstByte - pcmTime);
+    return true;
+}
+
+static void report(const char* what, std::vector<double>& values) {
+    std::sort(values.begin(), values.end());
+    printf("%-24s min %7.2f  median %7.2f  max %7.2f ms\n", what, values.front(), values[values.size() / 2], values.back());
+}
+
+int main(int argc, char* argv[]) {
+    unsigned runs = argc > 1 ? atoi(argv[1]) : 20;
+    milliseconds delay(argc > 2 ? atoi(argv[2]) : 100);
+    const char* codec = argc > 3 ? argv[3] : "pcm";
+    std::vector<double> fromRequest, fromPcm;
+
+    for (unsigned i = 0; i < runs; i++) {
+        double request, pcm;
+        if (!run(i, codec, delay, request, pcm)) return 1;
+        fromRequest.push_back(request);
+        fromPcm.push_back(pcm);
+    }
+
+    printf("%u runs, %s, PCM arrives %lld ms after request\n", runs, codec, (long long) delay.count());
+    report("first byte after request", fromRequest);
+    report("first byte after PCM", fromPcm);
+    HTTPlistener::closeAll();
+    HTTPreactor::closeAll();
+    encodePool::stop();
+    return 0;
+}